@@ -26,6 +26,11 @@
 #ifndef _LIBCMAP_H_
 #define _LIBCMAP_H_
 
+#include <libcmap/durablemap.h>
+#include <libcmap/internpool.h>
+#include <libcmap/maptrace.h>
 #include <libcmap/orderedmap.h>
+#include <libcmap/orderedmultimap.h>
+#include <libcmap/radixmap.h>
 
 #endif /* _LIBCMAP_H_ */
@@ -0,0 +1,164 @@
+/*
+ * Copyright (c) 2012-2023  Charles Hardin <ckhardin@gmail.com>
+ * All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/**
+ * @file durablemap.h
+ *
+ * Ordered map that survives a restart. Every change is appended to a
+ * checksummed log next to the map and made durable before the call
+ * returns, with concurrent writers sharing one fsync (group commit).
+ * Opening the map replays the last snapshot and the log, and once the
+ * log grows past a limit a background thread folds it into a new
+ * snapshot so recovery stays short.
+ *
+ * The files used are <path>.snap, <path>.snap.tmp, <path>.log and
+ * <path>.log.old.
+ */
+#pragma once
+
+#include <sys/cdefs.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <libcmap/orderedmap.h>
+
+/* log size that starts a compaction when none is given to open */
+#define DURABLEMAP_COMPACTSIZE	(4 * 1024 * 1024)
+
+/* forward declare */
+typedef struct durablemap durablemap_t;
+
+struct durablemap {
+	/* current contents, guarded by dm_lock */
+	orderedmap_t dm_map;
+	pthread_mutex_t dm_lock;
+
+	/* active log and group commit state */
+	int dm_fd;
+	char *dm_path;
+	uint64_t dm_lsn;
+	uint64_t dm_synclsn;
+	bool dm_syncing;
+	pthread_cond_t dm_synced;
+	size_t dm_logsize;
+	int dm_error;
+
+	/* background compaction */
+	size_t dm_compactsize;
+	bool dm_compactreq;
+	bool dm_closing;
+	pthread_cond_t dm_work;
+	pthread_mutex_t dm_compactlock;
+	pthread_t dm_thread;
+};
+
+
+__BEGIN_DECLS
+
+/**
+ * Open or create a durable map at path and recover its contents. A
+ * record torn at the end of the log by a crash, a short header or a
+ * header followed only by zeros, is dropped. Any other damaged record
+ * fails the open with EIO and leaves the files as they are.
+ *
+ * @param  dm           reference to a durable map to be opened
+ * @param  path         base path of the map files
+ * @param  compactsize  log size that starts a compaction, zero for the
+ *                      default #DURABLEMAP_COMPACTSIZE
+ * @return zero on success or an errno value
+ */
+extern int durablemap_open(durablemap_t *dm, const char *path,
+	size_t compactsize);
+
+/**
+ * Stop the background work, flush the log and free the map.
+ *
+ * @param  dm  reference that has been opened by #durablemap_open
+ * @return zero on success or an errno value
+ */
+extern int durablemap_close(durablemap_t *dm);
+
+/**
+ * Insert a key that is not in the map yet, see #orderedmap_insert.
+ * The change is durable when this returns zero.
+ *
+ * @param  dm   reference that has been opened by #durablemap_open
+ * @param  key  null terminated string that names the value
+ * @param  val  null terminated string - void pointer avoids casts
+ * @return zero on success, EPERM if the key exists or an errno value
+ */
+extern int durablemap_insert(durablemap_t *dm, const char *key,
+	const void *val);
+
+/**
+ * Insert a key or replace its value. The change is durable when this
+ * returns zero.
+ *
+ * @param  dm   reference that has been opened by #durablemap_open
+ * @param  key  null terminated string that names the value
+ * @param  val  null terminated string - void pointer avoids casts
+ * @return zero on success or an errno value
+ */
+extern int durablemap_set(durablemap_t *dm, const char *key,
+	const void *val);
+
+/**
+ * Remove a key. The change is durable when this returns zero.
+ *
+ * @param  dm   reference that has been opened by #durablemap_open
+ * @param  key  null terminated string that names the element
+ * @return zero on success, ENOENT if the key is missing or an errno value
+ */
+extern int durablemap_erase(durablemap_t *dm, const char *key);
+
+/**
+ * Write a snapshot of the map and drop the log records it covers,
+ * waiting for the result rather than leaving it to the background.
+ *
+ * @param  dm  reference that has been opened by #durablemap_open
+ * @return zero on success or an errno value
+ */
+extern int durablemap_compact(durablemap_t *dm);
+
+/**
+ * Lock out writers so the map returned by #durablemap_map can be
+ * read. Must be paired with #durablemap_unlock.
+ *
+ * @param  dm  reference that has been opened by #durablemap_open
+ */
+extern void durablemap_lock(durablemap_t *dm);
+extern void durablemap_unlock(durablemap_t *dm);
+
+/**
+ * Return the map with the current contents, only to be read while
+ * holding #durablemap_lock.
+ *
+ * @param  dm  reference that has been opened by #durablemap_open
+ * @return pointer to the map
+ */
+extern const orderedmap_t *durablemap_map(const durablemap_t *dm);
+
+__END_DECLS
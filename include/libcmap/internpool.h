@@ -0,0 +1,123 @@
+/*
+ * Copyright (c) 2012-2023  Charles Hardin <ckhardin@gmail.com>
+ * All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/**
+ * @file internpool.h
+ *
+ * Shared pool of interned strings. Maps that hold the same key names
+ * can be bound to one pool so each distinct key is stored once, and
+ * the nodes only keep a handle to the pooled bytes. A handle is a
+ * pointer to a null terminated string, so two handles from the same
+ * pool name the same key exactly when the pointers are equal.
+ *
+ * The pool is safe to use from multiple threads, the maps bound to it
+ * keep their usual single writer rules. That safety is not free: every
+ * intern and release hashes the string and takes the lock of its
+ * shard, so each insert and erase on a bound map pays for both. A pool
+ * saves the key bytes of each node and pays off when many maps hold
+ * the same, longer keys; a map with unique or short keys is faster
+ * left unbound.
+ */
+#pragma once
+
+#include <sys/cdefs.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define INTERNPOOL_NUMSHARDS	16
+
+/* forward declare */
+typedef struct internpool internpool_t;
+struct internpoolentry;
+
+struct internpoolshard {
+	pthread_mutex_t ips_lock;
+	size_t ips_numentries;
+	size_t ips_numbuckets;
+	struct internpoolentry **ips_buckets;
+};
+
+struct internpool {
+	/* entries are spread over shards by hash to reduce contention */
+	struct internpoolshard ip_shards[INTERNPOOL_NUMSHARDS];
+};
+
+
+__BEGIN_DECLS
+
+/**
+ * Initialize a pool to an empty state.
+ *
+ * @param  pool  reference to a pool to be initialized
+ * @return zero on success or an errno value
+ */
+extern int internpool_init(internpool_t *pool);
+
+/**
+ * Free the resources held by the pool. Every handle has to have been
+ * released, so any map bound to the pool must be destroyed first.
+ *
+ * @param  pool  reference that has been initialized by #internpool_init
+ * @return zero on success, EBUSY if handles are outstanding
+ */
+extern int internpool_destroy(internpool_t *pool);
+
+/**
+ * Return the handle for the string and take a reference on it. The
+ * string is copied into the pool the first time it is seen.
+ *
+ * @param  pool    reference that has been initialized by #internpool_init
+ * @param  str     bytes of the string, need not be null terminated
+ * @param  len     number of bytes in str
+ * @return handle to the pooled string or null if out of memory
+ */
+extern const char *internpool_intern(internpool_t *pool, const char *str,
+	size_t len);
+
+/**
+ * Take another reference on a handle returned by #internpool_intern.
+ *
+ * @param  pool    pool the handle came from
+ * @param  handle  pooled string
+ */
+extern void internpool_retain(internpool_t *pool, const char *handle);
+
+/**
+ * Drop a reference on a handle, the string is freed with the last one.
+ *
+ * @param  pool    pool the handle came from
+ * @param  handle  pooled string
+ */
+extern void internpool_release(internpool_t *pool, const char *handle);
+
+/**
+ * Return the number of distinct strings held by the pool.
+ *
+ * @param  pool  reference that has been initialized by #internpool_init
+ * @return count of pooled strings
+ */
+extern size_t internpool_count(internpool_t *pool);
+
+__END_DECLS
@@ -0,0 +1,174 @@
+/*
+ * Copyright (c) 2012-2023  Charles Hardin <ckhardin@gmail.com>
+ * All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/**
+ * @file maptrace.h
+ *
+ * Compact binary trace of the operations made on a map. A recorder
+ * attached with #orderedmap_trace logs every insert, lookup, erase
+ * and clear, with each distinct key written once and referred to by
+ * a small id after that. Values are not kept, only their length, so
+ * a trace can be taken from a production map and replayed elsewhere,
+ * see tools/cmap_replay.c.
+ *
+ * A recorder serves one map at a time and follows the single writer
+ * rules of that map.
+ */
+#pragma once
+
+#include <sys/cdefs.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <libcmap/orderedmap.h>
+
+/* forward declare */
+typedef struct maptrace maptrace_t;
+typedef struct maptrace_reader maptrace_reader_t;
+typedef struct maptrace_op maptrace_op_t;
+
+typedef enum {
+	MAPTRACE_INSERT = 1,
+	MAPTRACE_FIND = 2,
+	MAPTRACE_ERASE = 3,
+	MAPTRACE_CLEAR = 4
+} maptrace_optype_t;
+
+struct maptrace {
+	FILE *mt_fp;
+	orderedmap_t mt_keys;	/* key to id dictionary */
+	uint64_t mt_numkeys;
+	uint64_t mt_numops;
+	int mt_error;		/* first failure, reported by close */
+};
+
+struct maptrace_reader {
+	FILE *mtr_fp;
+	char **mtr_keys;	/* null terminated copies, indexed by id */
+	size_t *mtr_keylens;
+	size_t mtr_numkeys;
+	size_t mtr_maxkeys;
+};
+
+/*
+ * One operation read back from a trace. The key is owned by the
+ * reader and stays valid until it is closed.
+ */
+struct maptrace_op {
+	maptrace_optype_t mto_type;
+	size_t mto_keyid;
+	const char *mto_key;	/* null for MAPTRACE_CLEAR */
+	size_t mto_keylen;
+	size_t mto_vallen;	/* value length of an insert */
+};
+
+
+__BEGIN_DECLS
+
+/**
+ * Create a trace file and initialize a recorder writing to it.
+ *
+ * @param  trace  reference to a recorder to be initialized
+ * @param  path   file to create, an existing file is truncated
+ * @return zero on success or an errno value
+ */
+extern int maptrace_open(maptrace_t *trace, const char *path);
+
+/**
+ * Flush and close the trace file. Any map still attached has to be
+ * detached first.
+ *
+ * @param  trace  reference that has been opened by #maptrace_open
+ * @return zero on success or the first error hit while recording
+ */
+extern int maptrace_close(maptrace_t *trace);
+
+/**
+ * Append an operation to the trace. This is what the map hook calls,
+ * and can be used to trace other containers by hand.
+ *
+ * @param  trace   reference that has been opened by #maptrace_open
+ * @param  type    kind of operation
+ * @param  key     bytes of the key, ignored for MAPTRACE_CLEAR
+ * @param  keylen  number of bytes in key
+ * @param  vallen  value length for MAPTRACE_INSERT, otherwise ignored
+ */
+extern void maptrace_record(maptrace_t *trace, maptrace_optype_t type,
+	const char *key, size_t keylen, size_t vallen);
+
+/**
+ * Attach a recorder to a map, or detach it with a null trace. From
+ * then on the map records
+ *
+ *   - an insert for #orderedmap_insert, #orderedmap_insertn, the hint
+ *     and borrowed forms, and #orderedmap_insert_map,
+ *   - a find for #orderedmap_find, #orderedmap_findn, and for every
+ *     path segment that #orderedmap_find_path or
+ *     #orderedmap_find_path_v looks up in this map,
+ *   - an erase for #orderedmap_erase and #orderedmap_erase_node,
+ *   - a clear for #orderedmap_clear.
+ *
+ * A call built on other calls is recorded as the operations it
+ * performs: #orderedmap_update, #orderedmap_apply_patch and the typed
+ * update functions log their lookups, erases and inserts, including
+ * the tables they create. A value those calls replace in place is
+ * logged as an erase and an insert of the key. Walking the map,
+ * diffs, compaction and the memory report are not recorded, nor is
+ * anything done to a nested table, which is a map of its own.
+ *
+ * @param  map    reference that has been initialized by #map_init
+ * @param  trace  reference that has been opened by #maptrace_open
+ * @return zero on success or an errno value
+ */
+extern int orderedmap_trace(orderedmap_t *map, maptrace_t *trace);
+
+/**
+ * Open a trace file for reading.
+ *
+ * @param  reader  reference to a reader to be initialized
+ * @param  path    trace file written by a recorder
+ * @return zero on success, EINVAL if it is not a trace or an errno value
+ */
+extern int maptrace_reader_open(maptrace_reader_t *reader, const char *path);
+
+/**
+ * Free the reader and the keys it handed out.
+ *
+ * @param  reader  reference that has been opened by #maptrace_reader_open
+ * @return zero on success or an errno value
+ */
+extern int maptrace_reader_close(maptrace_reader_t *reader);
+
+/**
+ * Read the next operation from the trace.
+ *
+ * @param  reader  reference that has been opened by #maptrace_reader_open
+ * @param  op      filled in with the operation
+ * @return zero on success, ENOENT at the end of the trace, EIO for a
+ *         truncated or corrupt trace or an errno value
+ */
+extern int maptrace_read(maptrace_reader_t *reader, maptrace_op_t *op);
+
+__END_DECLS
@@ -33,16 +33,146 @@
 
 #include <sys/cdefs.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 /* forward declare */
 typedef struct orderedmap orderedmap_t;
 typedef struct orderedmapnode orderedmapnode_t;
+typedef struct orderedmap_usage orderedmap_usage_t;
+struct internpool;
+struct orderedmapblock;
+struct orderedmapowned;
+struct maptrace;
+
+/* capacity limit of a block that #orderedmap_compact packs nodes into */
+#define ORDEREDMAP_BLOCKSIZE	(64 * 1024)
+
+/**
+ * Key comparison function used to order the map. The keys are passed
+ * with explicit lengths so a comparison never has to rescan for the
+ * terminator, and the return follows the strcmp convention.
+ */
+typedef int (*orderedmap_cmp_t)(const char *a, size_t alen,
+	const char *b, size_t blen, void *ctx);
+
+/**
+ * Kind of difference reported by #orderedmap_diff.
+ */
+typedef enum {
+	ORDEREDMAP_DIFF_ADDED = 0,	/* key only in the new map */
+	ORDEREDMAP_DIFF_REMOVED,	/* key only in the old map */
+	ORDEREDMAP_DIFF_CHANGED		/* key in both, value differs */
+} orderedmap_diffop_t;
+
+/**
+ * Callback for #orderedmap_diff. The old node is null for an added
+ * key and the new node is null for a removed key. The path holds the
+ * depth table nodes of the new map that enclose the reported key,
+ * outermost first, and is empty for a key of the top map. A non-zero
+ * return stops the diff and is returned to the caller.
+ */
+typedef int (*orderedmap_diff_t)(orderedmap_diffop_t op,
+	const orderedmapnode_t *const *path, size_t depth,
+	const orderedmapnode_t *oldnode, const orderedmapnode_t *newnode,
+	void *ctx);
+
+/**
+ * Release function for a buffer handed to #orderedmap_adopt, called
+ * with the buffer and the opaque argument when the map is destroyed.
+ */
+typedef void (*orderedmap_release_t)(void *buf, void *arg);
 
 struct orderedmap {
 	/* red black tree root node */
 	int om_numnodes;
 	struct orderedmapnode *om_root;
+
+	/* rightmost node, so appending a larger key skips the descent */
+	struct orderedmapnode *om_last;
+
+	/* key ordering - null is a plain byte comparison */
+	orderedmap_cmp_t om_cmp;
+	void *om_cmpctx;
+
+	/* shared key storage - null when keys are copied into nodes */
+	struct internpool *om_pool;
+
+	/* blocks holding compacted nodes and the incremental pass state */
+	struct orderedmapblock *om_blocks;
+	struct orderedmapblock *om_compactblock;
+	struct orderedmapnode *om_compactnext;
+	int om_compactmoved;
+	bool om_compacting;
+
+	/* caller buffers released on destroy, see #orderedmap_adopt */
+	struct orderedmapowned *om_owned;
+
+	/* operation recorder, see maptrace.h */
+	struct maptrace *om_trace;
+};
+
+/*
+ * The node layout is public so a caller can read the key and value
+ * and so the C++ wrapper can inline the tree descent. The tree links
+ * must only be changed by the library.
+ */
+struct orderedmapnode {
+	enum {
+		OMN_RED = 0,
+		OMN_BLACK = 1
+	} omn_color;
+	enum {
+		OMN_STRING = 0,	/* omn_val is the value */
+		OMN_MAP = 1	/* value is a table, see #orderedmap_getmap */
+	} omn_kind;
+	struct orderedmapnode *omn_parent;
+	struct orderedmapnode *omn_child[2]; /* 0 - left and 1 - right */
+
+	size_t omn_keylen;
+	size_t omn_vallen;
+	const char *omn_key;
+	const char *omn_val;
+
+	/* block the node was packed into or null for its own allocation */
+	struct orderedmapblock *omn_block;
+
+	/* key and value are caller memory, see #orderedmap_insert_borrowed */
+	bool omn_borrowed;
+
+	/* bytes the node was given in its block, a value can shrink later */
+	uint32_t omn_blocksize;
+};
+
+/*
+ * Memory report filled by #orderedmap_memory_usage. Nodes that are
+ * separate allocations are scattered over the heap, an erased node
+ * inside a block leaves dead space until the whole block is unused,
+ * and a value shrunk in place leaves slack in its packed node. Any of
+ * them growing large means #orderedmap_compact is worth running.
+ */
+struct orderedmap_usage {
+	size_t omu_numnodes;	/* live nodes, nested tables included */
+	size_t omu_nodebytes;	/* bytes the live nodes and tables need */
+	size_t omu_blocknodes;	/* live nodes packed into blocks */
+	size_t omu_numblocks;
+	size_t omu_blockbytes;	/* bytes allocated for blocks */
+	size_t omu_deadbytes;	/* block bytes no live node holds */
+	size_t omu_slackbytes;	/* bytes packed nodes hold but no longer use */
+};
+
+
+/*
+ * A recorded set of changes that turns one map into another, filled
+ * by passing #orderedmap_patch_record to #orderedmap_diff.
+ */
+typedef struct orderedmap_patch orderedmap_patch_t;
+struct orderedmap_patchentry;
+
+struct orderedmap_patch {
+	size_t omp_numentries;
+	size_t omp_maxentries;
+	struct orderedmap_patchentry **omp_entries;
 };
 
 
@@ -57,6 +187,32 @@ __BEGIN_DECLS
  */
 extern int orderedmap_init(orderedmap_t *map);
 
+/**
+ * Initialize a map that orders the keys with a caller supplied
+ * comparison function. The function and context have to remain
+ * valid for the lifetime of the map.
+ *
+ * @param  map  reference to a container to be initialized
+ * @param  cmp  key comparison or null for a byte comparison
+ * @param  ctx  opaque pointer handed to every cmp call
+ * @return zero on success or an errno value
+ */
+extern int orderedmap_init_cmp(orderedmap_t *map, orderedmap_cmp_t cmp,
+	void *ctx);
+
+/**
+ * Bind an empty map to a shared intern pool. The keys of any later
+ * insert are interned in the pool rather than copied into the node,
+ * so the node key is a pool handle. The pool has to outlive the map.
+ * Every insert and erase on a bound map hashes the key and takes a
+ * pool shard lock, see internpool.h.
+ *
+ * @param  map   reference that has been initialized by #map_init
+ * @param  pool  pool from #internpool_init or null to unbind
+ * @return zero on success, EBUSY if the map is not empty
+ */
+extern int orderedmap_bind_pool(orderedmap_t *map, struct internpool *pool);
+
 /**
  * Free up any resources in the map and return the container
  * to a known state.
@@ -71,7 +227,7 @@ extern int orderedmap_destroy(orderedmap_t *map);
  * the key value pair. Since maps don't allow duplicate keys,
  * if the same key is already in the map it will not be changed
  * and an error will be returned. For duplicate values see
- * the multimap reference.
+ * orderedmultimap.h.
  *
  * @param  map  reference that has been initialized by #map_init
  * @param  key  null terminated string that names the value
@@ -81,6 +237,118 @@ extern int orderedmap_destroy(orderedmap_t *map);
 extern int orderedmap_insert(orderedmap_t *map, const char *key,
 	const void *val);
 
+/**
+ * Same as #orderedmap_insert with explicit lengths, so the key and
+ * value do not need to be null terminated. The stored copies are.
+ *
+ * @param  map     reference that has been initialized by #map_init
+ * @param  key     bytes that name the value
+ * @param  keylen  number of bytes in key
+ * @param  val     bytes of the value
+ * @param  vallen  number of bytes in val
+ * @return zero on success or an errno value
+ */
+extern int orderedmap_insertn(orderedmap_t *map, const char *key,
+	size_t keylen, const void *val, size_t vallen);
+
+/**
+ * Insert a key value pair without copying the bytes. The node points
+ * at the caller memory, which has to stay unchanged for as long as
+ * the node is in the map; adopting the buffer with #orderedmap_adopt
+ * ties its lifetime to the map. The key and value of such a node are
+ * not null terminated unless the caller bytes are. A map bound to an
+ * intern pool still interns the key. Replacing the value later makes
+ * a copy and never writes to the caller memory.
+ *
+ * @param  map     reference that has been initialized by #map_init
+ * @param  key     bytes that name the value
+ * @param  keylen  number of bytes in key
+ * @param  val     bytes of the value
+ * @param  vallen  number of bytes in val
+ * @return zero on success, EPERM if the key exists or an errno value
+ */
+extern int orderedmap_insert_borrowed(orderedmap_t *map, const char *key,
+	size_t keylen, const void *val, size_t vallen);
+
+/**
+ * Hand a buffer over to the map, to be released when the map is
+ * destroyed. This is meant for the file mapping or parser buffer
+ * that borrowed nodes point into.
+ *
+ * @param  map      reference that has been initialized by #map_init
+ * @param  buf      buffer to be released
+ * @param  release  function to release buf or null for free
+ * @param  arg      opaque pointer passed to release
+ * @return zero on success or an errno value
+ */
+extern int orderedmap_adopt(orderedmap_t *map, void *buf,
+	orderedmap_release_t release, void *arg);
+
+/**
+ * Same as #orderedmap_insert, but first tries to place the key next
+ * to a node that is expected to be its neighbor. A good hint links
+ * the node without descending from the root, otherwise the insert
+ * falls back to the full lookup. The hint is updated to the inserted
+ * node, or the existing node on EPERM, so a caller inserting keys
+ * in clustered or sorted order can keep passing the same cursor.
+ * A null hint is a plain insert, which is already constant time for
+ * a key larger than any in the map.
+ *
+ * @param  map   reference that has been initialized by #map_init
+ * @param  hint  in and out cursor, a node of the map or null
+ * @param  key   null terminated string that names the value
+ * @param  val   null terminated string - void pointer avoids casts
+ * @return zero on success or an errno value
+ */
+extern int orderedmap_insert_hint(orderedmap_t *map, orderedmapnode_t **hint,
+	const char *key, const void *val);
+
+/**
+ * Same as #orderedmap_insert_hint with explicit lengths.
+ *
+ * @param  map     reference that has been initialized by #map_init
+ * @param  hint    in and out cursor, a node of the map or null
+ * @param  key     bytes that name the value
+ * @param  keylen  number of bytes in key
+ * @param  val     bytes of the value
+ * @param  vallen  number of bytes in val
+ * @return zero on success or an errno value
+ */
+extern int orderedmap_insertn_hint(orderedmap_t *map, orderedmapnode_t **hint,
+	const char *key, size_t keylen, const void *val, size_t vallen);
+
+/**
+ * Insert a nested table under the key. The table is an empty map
+ * that is ordered and stores its keys like the parent map, and is
+ * owned by the parent node so it is freed with it. If the key is
+ * already present EPERM is returned, and if that key holds a table
+ * it is also returned in child so it can be filled in further.
+ *
+ * The table is allocated apart from the node, so the child pointer
+ * stays valid while the node moves in the parent, for example when
+ * the parent is compacted or updated from a map with a table under
+ * the same key. It is freed, and the pointer becomes invalid, when
+ * the key is erased or its value is replaced with a string, and
+ * when the parent is cleared or destroyed.
+ *
+ * @param  map    reference that has been initialized by #map_init
+ * @param  key    null terminated string that names the table
+ * @param  child  set to the nested table
+ * @return zero on success or an errno value
+ */
+extern int orderedmap_insert_map(orderedmap_t *map, const char *key,
+	orderedmap_t **child);
+
+/**
+ * Return the nested table held by a node or null if the node holds
+ * a string value. The table lives as long as the key holds it, see
+ * #orderedmap_insert_map, even if the node itself is moved.
+ *
+ * @param  node  reference to a node stored in the map
+ * @return pointer to the nested table or null
+ */
+extern orderedmap_t *orderedmap_getmap(const orderedmapnode_t *node);
+
 /**
  * Remove the element in the map that is named by the key
  * parameter.
@@ -91,9 +359,21 @@ extern int orderedmap_insert(orderedmap_t *map, const char *key,
  */
 extern int orderedmap_erase(orderedmap_t *map, const char *key);
 
+/**
+ * Remove and free a node that was returned from a lookup on the
+ * same map. The node pointer is invalid after the call.
+ *
+ * @param  map   reference that has been initialized by #map_init
+ * @param  node  element of the map to remove
+ * @return zero on success or an errno value
+ */
+extern int orderedmap_erase_node(orderedmap_t *map, orderedmapnode_t *node);
+
 /**
  * Update the map with another maps key and values. This is modeled
- * after the python update method.
+ * after the python update method. Tables are copied deep, and a
+ * table that is already under the key in map is emptied and filled
+ * with the copy so pointers to it stay valid.
  *
  * @param  map    first map that has been initialized by #map_init
  * @param  other  the source location of the values to update with
@@ -101,6 +381,67 @@ extern int orderedmap_erase(orderedmap_t *map, const char *key);
  */
 extern int orderedmap_update(orderedmap_t *map, const orderedmap_t *other);
 
+/**
+ * Compare two maps and report every key that was added, removed or
+ * had its value changed going from the old map to the new one. Both
+ * maps are walked once in key order, so the cost is O(n + m). The
+ * maps have to be ordered by the same comparison function. A key that
+ * holds a table in both maps is not reported itself, the two tables
+ * are compared in turn and their differences reported with the key
+ * on the path. A key that changes between a table and a value is
+ * reported as changed.
+ *
+ * @param  oldmap  map with the previous contents
+ * @param  newmap  map with the current contents
+ * @param  cb      function called for every difference in key order
+ * @param  ctx     opaque pointer passed to cb
+ * @return zero, the first non-zero value from cb or an errno value
+ */
+extern int orderedmap_diff(const orderedmap_t *oldmap,
+	const orderedmap_t *newmap, orderedmap_diff_t cb, void *ctx);
+
+/**
+ * Initialize an empty patch.
+ *
+ * @param  patch  reference to a patch to be initialized
+ * @return zero on success or an errno value
+ */
+extern int orderedmap_patch_init(orderedmap_patch_t *patch);
+
+/**
+ * Free all the recorded changes in a patch.
+ *
+ * @param  patch  reference that has been initialized by #orderedmap_patch_init
+ * @return zero on success or an errno value
+ */
+extern int orderedmap_patch_destroy(orderedmap_patch_t *patch);
+
+/**
+ * Diff callback that copies each difference into the patch passed
+ * as the context, use as orderedmap_diff(old, new,
+ * orderedmap_patch_record, &patch).
+ */
+extern int orderedmap_patch_record(orderedmap_diffop_t op,
+	const orderedmapnode_t *const *path, size_t depth,
+	const orderedmapnode_t *oldnode, const orderedmapnode_t *newnode,
+	void *ctx);
+
+/**
+ * Apply a patch to the map in place. Every key in the patch is put
+ * in its new state: removed keys are erased if present, added and
+ * changed keys are inserted or have their value replaced. A change
+ * inside a table is applied to the table already in the map, which
+ * is created if it is missing. Keys that are not in the patch are
+ * not touched. On an error the changes before the failing entry
+ * remain applied.
+ *
+ * @param  map    reference that has been initialized by #map_init
+ * @param  patch  changes recorded by #orderedmap_patch_record
+ * @return zero on success or an errno value
+ */
+extern int orderedmap_apply_patch(orderedmap_t *map,
+	const orderedmap_patch_t *patch);
+
 /**
  * Clear all key value pairs from the map, but change no other
  * information that has been set in the map.
@@ -110,6 +451,47 @@ extern int orderedmap_update(orderedmap_t *map, const orderedmap_t *other);
  */
 extern int orderedmap_clear(orderedmap_t *map);
 
+/**
+ * Relocate every node into blocks of contiguous memory laid out in
+ * key order, so walking and searching the map touch neighboring
+ * cache lines. The contents and ordering do not change, but the node
+ * pointers do, so any node pointer held by the caller is stale after
+ * this. A block is freed once none of its nodes are in use. Nested
+ * tables are maps of their own and are compacted separately; they do
+ * not move with their node, so pointers from #orderedmap_getmap stay
+ * valid. The map inside an orderedmultimap has its own node layout
+ * and must not be compacted.
+ *
+ * @param  map  reference that has been initialized by #map_init
+ * @return zero on success or an errno value
+ */
+extern int orderedmap_compact(orderedmap_t *map);
+
+/**
+ * Incremental form of #orderedmap_compact that relocates at most
+ * budget nodes per call, so it can run in idle time without a long
+ * pause. The pass resumes where the last call stopped, and the map
+ * can be changed freely between calls. Node pointers held across a
+ * call may be stale, pointers to nested tables are not.
+ *
+ * @param  map     reference that has been initialized by #map_init
+ * @param  budget  maximum number of nodes to relocate
+ * @return zero when the pass is complete, EAGAIN if nodes remain or
+ *         an errno value
+ */
+extern int orderedmap_compact_step(orderedmap_t *map, size_t budget);
+
+/**
+ * Report the memory used by the nodes of the map and its nested
+ * tables. This walks the whole map.
+ *
+ * @param  map    reference that has been initialized by #map_init
+ * @param  usage  report to fill in
+ * @return zero on success or an errno value
+ */
+extern int orderedmap_memory_usage(const orderedmap_t *map,
+	orderedmap_usage_t *usage);
+
 /**
  * Return the the node that matches the key parameter or a null
  * pointer if no match can be made
@@ -121,6 +503,42 @@ extern int orderedmap_clear(orderedmap_t *map);
 extern orderedmapnode_t *orderedmap_find(const orderedmap_t *map,
 	const char *key);
 
+/**
+ * Same as #orderedmap_find with an explicit key length, the key does
+ * not need to be null terminated.
+ *
+ * @param  map     reference that has been initialized by #map_init
+ * @param  key     bytes that name the element
+ * @param  keylen  number of bytes in key
+ * @return pointer to the matching node or null
+ */
+extern orderedmapnode_t *orderedmap_findn(const orderedmap_t *map,
+	const char *key, size_t keylen);
+
+/**
+ * Lookup a dotted path like "server.tls.cert" through nested tables.
+ * Each segment is compared in place, no key strings are built, so a
+ * key that itself has a dot can only be reached with
+ * #orderedmap_find_path_v.
+ *
+ * @param  map   reference that has been initialized by #map_init
+ * @param  path  null terminated segments separated by dots
+ * @return pointer to the node named by the last segment or null
+ */
+extern orderedmapnode_t *orderedmap_find_path(const orderedmap_t *map,
+	const char *path);
+
+/**
+ * Lookup a path given as an array of segments through nested tables.
+ *
+ * @param  map        reference that has been initialized by #map_init
+ * @param  segments   null terminated key for each level
+ * @param  nsegments  number of entries in segments
+ * @return pointer to the node named by the last segment or null
+ */
+extern orderedmapnode_t *orderedmap_find_path_v(const orderedmap_t *map,
+	const char *const *segments, size_t nsegments);
+
 /**
  * Return the first key entry in the map base on the comparison function
  *
@@ -130,7 +548,8 @@ extern orderedmapnode_t *orderedmap_find(const orderedmap_t *map,
 extern orderedmapnode_t *orderedmap_first(const orderedmap_t *map);
 
 /**
- * Return the last key entry in the map base on the comparison function
+ * Return the last key entry in the map base on the comparison function,
+ * this is cached so it does not walk the tree
  *
  * @param  map    first map that has been initialized by #map_init
  * @return pointer to the last node or null
@@ -155,6 +574,14 @@ extern orderedmapnode_t *orderedmap_next(const orderedmapnode_t *node);
  */
 extern orderedmapnode_t *orderedmap_prev(const orderedmapnode_t *node);
 
+/* Comparison functions that can be passed to #orderedmap_init_cmp. */
+extern int orderedmap_cmp_bytes(const char *a, size_t alen,
+	const char *b, size_t blen, void *ctx);
+extern int orderedmap_cmp_case(const char *a, size_t alen,
+	const char *b, size_t blen, void *ctx);
+extern int orderedmap_cmp_natural(const char *a, size_t alen,
+	const char *b, size_t blen, void *ctx);
+
 /* Declare some functions that work on standard types. */
 extern int orderedmap_insert_char(orderedmap_t *map, const char *key,
 	char val);
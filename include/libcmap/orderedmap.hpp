@@ -0,0 +1,374 @@
+/*
+ * Copyright (c) 2012-2023  Charles Hardin <ckhardin@gmail.com>
+ * All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/**
+ * @file orderedmap.hpp
+ *
+ * Header only C++20 wrapper around the C ordered map. The comparison
+ * is a template parameter, so the lookup descent is instantiated for
+ * each comparator and the compiler can inline the key comparison. The
+ * C library is handed a thunk of the same comparator for the insert
+ * and rebalance paths so both sides agree on the ordering.
+ */
+#pragma once
+
+#include <cctype>
+#include <cerrno>
+#include <concepts>
+#include <cstddef>
+#include <cstring>
+#include <iterator>
+#include <new>
+#include <string_view>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+
+#include <libcmap/orderedmap.h>
+
+namespace cmap {
+
+/**
+ * A comparator takes two keys and returns a strcmp style result.
+ */
+template <typename C>
+concept map_key_compare = requires(const C &cmp, std::string_view a,
+                                   std::string_view b) {
+    { cmp(a, b) } -> std::convertible_to<int>;
+};
+
+/** Byte wise ordering, the same as a map from #orderedmap_init. */
+struct bytes_compare {
+    int operator()(std::string_view a, std::string_view b) const noexcept {
+        return a.compare(b);
+    }
+};
+
+/** ASCII case insensitive ordering, "Key" and "key" are the same key. */
+struct case_compare {
+    int operator()(std::string_view a, std::string_view b) const noexcept {
+        std::size_t len = a.size() < b.size() ? a.size() : b.size();
+
+        for (std::size_t i = 0; i < len; i++) {
+            int ca = std::tolower(static_cast<unsigned char>(a[i]));
+            int cb = std::tolower(static_cast<unsigned char>(b[i]));
+            if (ca != cb)
+                return ca - cb;
+        }
+        return (a.size() > b.size()) - (a.size() < b.size());
+    }
+};
+
+/** Numeric aware ordering, matches #orderedmap_cmp_natural. */
+struct natural_compare {
+    static bool isdigit(char c) noexcept {
+        return c >= '0' && c <= '9';
+    }
+
+    int operator()(std::string_view a, std::string_view b) const noexcept {
+        std::size_t i = 0, j = 0;
+
+        while (i < a.size() && j < b.size()) {
+            if (!isdigit(a[i]) || !isdigit(b[j])) {
+                if (a[i] != b[j])
+                    return static_cast<unsigned char>(a[i]) -
+                           static_cast<unsigned char>(b[j]);
+                i++;
+                j++;
+                continue;
+            }
+
+            std::size_t ai = i, bj = j;
+            while (ai < a.size() && a[ai] == '0')
+                ai++;
+            while (bj < b.size() && b[bj] == '0')
+                bj++;
+            std::size_t ae = ai, be = bj;
+            while (ae < a.size() && isdigit(a[ae]))
+                ae++;
+            while (be < b.size() && isdigit(b[be]))
+                be++;
+
+            if (ae - ai != be - bj)
+                return ae - ai < be - bj ? -1 : 1;
+            int cmp = a.substr(ai, ae - ai).compare(b.substr(bj, be - bj));
+            if (cmp != 0)
+                return cmp;
+            if (ai - i != bj - j)
+                return ai - i < bj - j ? -1 : 1;
+            i = ae;
+            j = be;
+        }
+        return (i < a.size()) - (j < b.size());
+    }
+};
+
+template <map_key_compare Compare = bytes_compare>
+class ordered_map {
+  public:
+    using key_type = std::string_view;
+    using mapped_type = std::string_view;
+    using value_type = std::pair<std::string_view, std::string_view>;
+    using size_type = std::size_t;
+    using key_compare = Compare;
+
+    /**
+     * Iterator over the elements in key order. The elements are
+     * immutable, so dereference yields a key/value pair of views
+     * into the node storage. The map is kept so end() can step back
+     * to the last element.
+     */
+    class iterator {
+      public:
+        using iterator_concept = std::bidirectional_iterator_tag;
+        /*
+         * dereference yields a pair by value, which only meets the
+         * legacy input requirements, use std::ranges::prev and friends
+         * to step back
+         */
+        using iterator_category = std::input_iterator_tag;
+        using value_type = ordered_map::value_type;
+        using difference_type = std::ptrdiff_t;
+        using reference = value_type;
+
+        struct pointer {
+            value_type value;
+            const value_type *operator->() const noexcept { return &value; }
+        };
+
+        iterator() noexcept = default;
+        iterator(const orderedmap_t *map, const orderedmapnode_t *node) noexcept
+            : m_map(map), m_node(node) {}
+
+        reference operator*() const noexcept {
+            return {{m_node->omn_key, m_node->omn_keylen},
+                    {m_node->omn_val, m_node->omn_vallen}};
+        }
+        pointer operator->() const noexcept { return {**this}; }
+
+        iterator &operator++() noexcept {
+            m_node = orderedmap_next(m_node);
+            return *this;
+        }
+        iterator operator++(int) noexcept {
+            iterator tmp = *this;
+            ++*this;
+            return tmp;
+        }
+
+        iterator &operator--() noexcept {
+            m_node = m_node != nullptr ? orderedmap_prev(m_node)
+                                       : orderedmap_last(m_map);
+            return *this;
+        }
+        iterator operator--(int) noexcept {
+            iterator tmp = *this;
+            --*this;
+            return tmp;
+        }
+
+        bool operator==(const iterator &other) const noexcept {
+            return m_node == other.m_node;
+        }
+
+        /** underlying C node or null for end() */
+        const orderedmapnode_t *node() const noexcept { return m_node; }
+
+      private:
+        const orderedmap_t *m_map = nullptr;
+        const orderedmapnode_t *m_node = nullptr;
+    };
+    using const_iterator = iterator;
+    using reverse_iterator = std::reverse_iterator<iterator>;
+    using const_reverse_iterator = reverse_iterator;
+
+    ordered_map() : ordered_map(Compare()) {}
+
+    explicit ordered_map(const Compare &cmp) : m_cmp(cmp) {
+        init(m_map, m_cmp);
+    }
+
+    ~ordered_map() { orderedmap_destroy(&m_map); }
+
+    /* the C map holds a pointer to m_cmp, so the map is move only */
+    ordered_map(const ordered_map &) = delete;
+    ordered_map &operator=(const ordered_map &) = delete;
+
+    ordered_map(ordered_map &&other) noexcept
+        : m_map(other.m_map), m_cmp(std::move(other.m_cmp)) {
+        rebind(m_map, &other.m_cmp, &m_cmp);
+        init(other.m_map, other.m_cmp);
+    }
+
+    ordered_map &operator=(ordered_map &&other) noexcept {
+        if (this != &other) {
+            orderedmap_destroy(&m_map);
+            m_map = other.m_map;
+            m_cmp = std::move(other.m_cmp);
+            rebind(m_map, &other.m_cmp, &m_cmp);
+            init(other.m_map, other.m_cmp);
+        }
+        return *this;
+    }
+
+    iterator begin() const noexcept {
+        return iterator(&m_map, orderedmap_first(&m_map));
+    }
+    iterator end() const noexcept { return iterator(&m_map, nullptr); }
+
+    reverse_iterator rbegin() const noexcept { return reverse_iterator(end()); }
+    reverse_iterator rend() const noexcept {
+        return reverse_iterator(begin());
+    }
+
+    bool empty() const noexcept { return m_map.om_numnodes == 0; }
+    size_type size() const noexcept {
+        return static_cast<size_type>(m_map.om_numnodes);
+    }
+
+    /**
+     * Lookup the key by walking the tree with the inlined comparator.
+     * A view is enough, no terminated copy of the key is made.
+     */
+    iterator find(std::string_view key) const noexcept {
+        const orderedmapnode_t *node = m_map.om_root;
+
+        while (node != nullptr) {
+            int cmp = m_cmp(key, std::string_view(node->omn_key,
+                                                  node->omn_keylen));
+            if (cmp == 0)
+                return iterator(&m_map, node);
+            node = node->omn_child[cmp > 0];
+        }
+        return end();
+    }
+
+    bool contains(std::string_view key) const noexcept {
+        return find(key) != end();
+    }
+    size_type count(std::string_view key) const noexcept {
+        return contains(key) ? 1 : 0;
+    }
+
+    /**
+     * Insert a copy of the key and value. An existing key is left
+     * unchanged and the returned flag is false.
+     */
+    std::pair<iterator, bool> insert(std::string_view key,
+                                     std::string_view val) {
+        int err = orderedmap_insertn(&m_map, key.data(), key.size(),
+                                     val.data(), val.size());
+        if (err == ENOMEM)
+            throw std::bad_alloc();
+        if (err != 0 && err != EPERM)
+            throw std::system_error(err, std::generic_category());
+        return {find(key), err == 0};
+    }
+
+    /**
+     * Insert next to the hint, which is the element expected right
+     * after the key as with std::map. Inserting in ascending order
+     * with end() as the hint never descends the tree. Returns the
+     * element with the key, new or existing.
+     */
+    iterator insert(iterator hint, std::string_view key,
+                    std::string_view val) {
+        orderedmapnode_t *node = const_cast<orderedmapnode_t *>(hint.node());
+        orderedmapnode_t *prev = node != nullptr ? orderedmap_prev(node)
+                                                 : orderedmap_last(&m_map);
+
+        /* the C hint is the neighbor before the key when there is one */
+        if (prev != nullptr)
+            node = prev;
+        int err = orderedmap_insertn_hint(&m_map, &node, key.data(),
+                                          key.size(), val.data(), val.size());
+        if (err == ENOMEM)
+            throw std::bad_alloc();
+        if (err != 0 && err != EPERM)
+            throw std::system_error(err, std::generic_category());
+        return iterator(&m_map, node);
+    }
+
+    size_type erase(std::string_view key) noexcept {
+        iterator it = find(key);
+
+        if (it == end())
+            return 0;
+        erase(it);
+        return 1;
+    }
+
+    iterator erase(iterator pos) noexcept {
+        iterator next = std::next(pos);
+
+        orderedmap_erase_node(&m_map,
+                              const_cast<orderedmapnode_t *>(pos.node()));
+        return next;
+    }
+
+    void clear() noexcept { orderedmap_clear(&m_map); }
+
+    const key_compare &key_comp() const noexcept { return m_cmp; }
+
+    /** access for the C api, the ordering must not be changed */
+    orderedmap_t *native_handle() noexcept { return &m_map; }
+    const orderedmap_t *native_handle() const noexcept { return &m_map; }
+
+  private:
+    static int compare(const char *a, std::size_t alen, const char *b,
+                       std::size_t blen, void *ctx) {
+        const Compare *cmp = static_cast<const Compare *>(ctx);
+
+        return (*cmp)(std::string_view(a, alen), std::string_view(b, blen));
+    }
+
+    /*
+     * Point the map and the tables nested in it through native_handle()
+     * at the comparator's new home, they were created with the old one.
+     */
+    static void rebind(orderedmap_t &map, const Compare *from,
+                       Compare *to) noexcept {
+        if (map.om_cmpctx != from)
+            return;
+        map.om_cmpctx = to;
+        for (const orderedmapnode_t *node = orderedmap_first(&map);
+             node != nullptr; node = orderedmap_next(node)) {
+            if (node->omn_kind == orderedmapnode_t::OMN_MAP)
+                rebind(*orderedmap_getmap(node), from, to);
+        }
+    }
+
+    static void init(orderedmap_t &map, Compare &cmp) noexcept {
+        /* byte ordering uses the library fast path without a thunk */
+        if constexpr (std::is_same_v<Compare, bytes_compare>)
+            orderedmap_init(&map);
+        else
+            orderedmap_init_cmp(&map, compare, &cmp);
+    }
+
+    orderedmap_t m_map;
+    [[no_unique_address]] Compare m_cmp;
+};
+
+} // namespace cmap
@@ -0,0 +1,220 @@
+/*
+ * Copyright (c) 2012-2023  Charles Hardin <ckhardin@gmail.com>
+ * All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/**
+ * @file orderedmultimap.h
+ *
+ * Ordered container that allows a key to name more than one value.
+ * Each distinct key is a single tree node and its values are stored
+ * back to back in one growable run owned by that node, so the tree
+ * stays the size of the number of distinct keys no matter how many
+ * duplicates are inserted.
+ */
+#pragma once
+
+#include <sys/cdefs.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <libcmap/orderedmap.h>
+
+/* forward declare */
+typedef struct orderedmultimap orderedmultimap_t;
+typedef struct orderedmultimapnode orderedmultimapnode_t;
+
+struct orderedmultimap {
+	/* tree of distinct keys */
+	orderedmap_t omm_map;
+	size_t omm_numvals;
+};
+
+/*
+ * A distinct key and its values. The values are null terminated and
+ * stored one after the other in insertion order in ommn_run. The run
+ * starts out in the node allocation after the key and moves to its
+ * own buffer only when it outgrows that space.
+ */
+struct orderedmultimapnode {
+	struct orderedmapnode ommn_node; /* must be first */
+
+	size_t ommn_count;
+	size_t ommn_runlen;
+	size_t ommn_runcap;
+	char *ommn_run;
+};
+
+
+__BEGIN_DECLS
+
+/**
+ * Initialize a multimap to a known state.
+ *
+ * @param  mm  reference to a container to be initialized
+ * @return zero on success or an errno value
+ */
+extern int orderedmultimap_init(orderedmultimap_t *mm);
+
+/**
+ * Initialize a multimap that orders the keys with a caller supplied
+ * comparison function, see #orderedmap_init_cmp.
+ *
+ * @param  mm   reference to a container to be initialized
+ * @param  cmp  key comparison or null for a byte comparison
+ * @param  ctx  opaque pointer handed to every cmp call
+ * @return zero on success or an errno value
+ */
+extern int orderedmultimap_init_cmp(orderedmultimap_t *mm,
+	orderedmap_cmp_t cmp, void *ctx);
+
+/**
+ * Free up any resources in the multimap.
+ *
+ * @param  mm  reference that has been initialized by #orderedmultimap_init
+ * @return zero on success or an errno value
+ */
+extern int orderedmultimap_destroy(orderedmultimap_t *mm);
+
+/**
+ * Remove every key and value from the multimap.
+ *
+ * @param  mm  reference that has been initialized by #orderedmultimap_init
+ * @return zero on success or an errno value
+ */
+extern int orderedmultimap_clear(orderedmultimap_t *mm);
+
+/**
+ * Add a value to the key, after any values the key already has.
+ *
+ * @param  mm   reference that has been initialized by #orderedmultimap_init
+ * @param  key  null terminated string that names the value
+ * @param  val  null terminated string - void pointer avoids casts
+ * @return zero on success or an errno value
+ */
+extern int orderedmultimap_insert(orderedmultimap_t *mm, const char *key,
+	const void *val);
+
+/**
+ * Same as #orderedmultimap_insert with explicit lengths. The value
+ * must not hold a null byte.
+ */
+extern int orderedmultimap_insertn(orderedmultimap_t *mm, const char *key,
+	size_t keylen, const void *val, size_t vallen);
+
+/**
+ * Return the node that holds all the values of the key, which is the
+ * whole equal range for the key, or null if the key is not present.
+ * The values are visited with #orderedmultimap_value_first and
+ * #orderedmultimap_value_next.
+ *
+ * @param  mm   reference that has been initialized by #orderedmultimap_init
+ * @param  key  null terminated string that names the values
+ * @return pointer to the node or null
+ */
+extern orderedmultimapnode_t *orderedmultimap_equal_range(
+	const orderedmultimap_t *mm, const char *key);
+
+/**
+ * Store up to maxvals of the values of a key into vals in insertion
+ * order and return the number of values the key has, which can be
+ * more than maxvals.
+ *
+ * @param  mm       reference that has been initialized by #orderedmultimap_init
+ * @param  key      null terminated string that names the values
+ * @param  vals     array that receives pointers to the values
+ * @param  maxvals  number of entries in vals
+ * @return number of values of the key
+ */
+extern size_t orderedmultimap_find_all(const orderedmultimap_t *mm,
+	const char *key, const char **vals, size_t maxvals);
+
+/**
+ * Return the number of values stored for a key.
+ *
+ * @param  mm   reference that has been initialized by #orderedmultimap_init
+ * @param  key  null terminated string that names the values
+ * @return number of values, zero if the key is not present
+ */
+extern size_t orderedmultimap_count(const orderedmultimap_t *mm,
+	const char *key);
+
+/**
+ * Remove the first value of the key that is equal to val, the key is
+ * removed with its last value.
+ *
+ * @param  mm   reference that has been initialized by #orderedmultimap_init
+ * @param  key  null terminated string that names the values
+ * @param  val  null terminated value to remove
+ * @return zero on success or ENOENT if no such value
+ */
+extern int orderedmultimap_erase_one(orderedmultimap_t *mm, const char *key,
+	const void *val);
+
+/**
+ * Remove the key and all of its values.
+ *
+ * @param  mm   reference that has been initialized by #orderedmultimap_init
+ * @param  key  null terminated string that names the values
+ * @return zero on success or ENOENT if the key is not present
+ */
+extern int orderedmultimap_erase_all(orderedmultimap_t *mm, const char *key);
+
+/**
+ * Return the node of the first key in the multimap.
+ *
+ * @param  mm  reference that has been initialized by #orderedmultimap_init
+ * @return pointer to the first node or null
+ */
+extern orderedmultimapnode_t *orderedmultimap_first(
+	const orderedmultimap_t *mm);
+
+/**
+ * Return the node of the next distinct key.
+ *
+ * @param  node  reference to a node stored in the multimap
+ * @return pointer to the next node or null
+ */
+extern orderedmultimapnode_t *orderedmultimap_next(
+	const orderedmultimapnode_t *node);
+
+/**
+ * Return the first value of a node.
+ *
+ * @param  node  reference to a node stored in the multimap
+ * @return null terminated value
+ */
+extern const char *orderedmultimap_value_first(
+	const orderedmultimapnode_t *node);
+
+/**
+ * Return the value after val in the run of the node.
+ *
+ * @param  node  reference to a node stored in the multimap
+ * @param  val   value returned by a previous call for the node
+ * @return null terminated value or null after the last
+ */
+extern const char *orderedmultimap_value_next(
+	const orderedmultimapnode_t *node, const char *val);
+
+__END_DECLS
@@ -0,0 +1,247 @@
+/*
+ * Copyright (c) 2012-2023  Charles Hardin <ckhardin@gmail.com>
+ * All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/**
+ * @file radixmap.h
+ *
+ * Ordered name/value container built on an adaptive radix tree. The
+ * api mirrors orderedmap.h, but lookups branch on the key bytes and
+ * the inner nodes skip over prefixes their keys share, so long
+ * hierarchical keys ("cluster.region.az.service") are not compared
+ * over and over at every level. The leaves are also kept on a list in
+ * key order so iteration and prefix scans do not walk the tree.
+ *
+ * This trades memory for lookup speed: every leaf still holds a full
+ * copy of its key, so a shared prefix is stored once per key plus once
+ * in the inner nodes, not once overall.
+ *
+ * Keys are byte strings without embedded null bytes and are ordered
+ * the same as strcmp orders them.
+ */
+#pragma once
+
+#include <sys/cdefs.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* forward declare */
+typedef struct radixmap radixmap_t;
+typedef struct radixmapnode radixmapnode_t;
+
+struct radixmap {
+	/* adaptive radix tree root, either an inner node or a leaf */
+	int rm_numnodes;
+	void *rm_root;
+
+	/* leaves in key order */
+	struct radixmapnode *rm_head;
+	struct radixmapnode *rm_tail;
+};
+
+/*
+ * A leaf of the tree that holds one key value pair. The key and value
+ * are null terminated copies, the list links are owned by the library.
+ */
+struct radixmapnode {
+	struct radixmapnode *rmn_link[2]; /* 0 - prev and 1 - next */
+
+	size_t rmn_keylen;
+	size_t rmn_vallen;
+	const char *rmn_key;
+	const char *rmn_val;
+};
+
+/**
+ * Callback for #radixmap_walk_prefix, a non-zero return stops the
+ * walk and is returned to the caller.
+ */
+typedef int (*radixmap_walk_t)(const radixmapnode_t *node, void *ctx);
+
+
+__BEGIN_DECLS
+
+/**
+ * Initialize a map structure to a known state for all the following
+ * methods to work on the container.
+ *
+ * @param  map  reference to a container to be initialized
+ * @return zero on success or an errno value
+ */
+extern int radixmap_init(radixmap_t *map);
+
+/**
+ * Free up any resources in the map and return the container
+ * to a known state.
+ *
+ * @param  map  reference that has been initialized by #radixmap_init
+ * @return zero on success or an errno value
+ */
+extern int radixmap_destroy(radixmap_t *map);
+
+/**
+ * Insert a new element with the key value pair. If the key is
+ * already in the map it will not be changed and an error will be
+ * returned.
+ *
+ * @param  map  reference that has been initialized by #radixmap_init
+ * @param  key  null terminated string that names the value
+ * @param  val  null terminated string - void pointer avoids casts
+ * @return zero on success or an errno value
+ */
+extern int radixmap_insert(radixmap_t *map, const char *key,
+	const void *val);
+
+/**
+ * Same as #radixmap_insert with explicit lengths. The key must not
+ * hold a null byte.
+ *
+ * @param  map     reference that has been initialized by #radixmap_init
+ * @param  key     bytes that name the value
+ * @param  keylen  number of bytes in key
+ * @param  val     bytes of the value
+ * @param  vallen  number of bytes in val
+ * @return zero on success or an errno value
+ */
+extern int radixmap_insertn(radixmap_t *map, const char *key,
+	size_t keylen, const void *val, size_t vallen);
+
+/**
+ * Remove the element in the map that is named by the key parameter.
+ *
+ * @param  map  reference that has been initialized by #radixmap_init
+ * @param  key  null terminated string that names the element
+ * @return zero on success or an errno value
+ */
+extern int radixmap_erase(radixmap_t *map, const char *key);
+
+/**
+ * Same as #radixmap_erase with an explicit key length.
+ *
+ * @param  map     reference that has been initialized by #radixmap_init
+ * @param  key     bytes that name the element
+ * @param  keylen  number of bytes in key
+ * @return zero on success or an errno value
+ */
+extern int radixmap_erasen(radixmap_t *map, const char *key, size_t keylen);
+
+/**
+ * Update the map with another maps key and values.
+ *
+ * @param  map    first map that has been initialized by #radixmap_init
+ * @param  other  the source location of the values to update with
+ * @return zero on success or an errno value
+ */
+extern int radixmap_update(radixmap_t *map, const radixmap_t *other);
+
+/**
+ * Clear all key value pairs from the map.
+ *
+ * @param  map  reference that has been initialized by #radixmap_init
+ * @return zero on success or an errno value
+ */
+extern int radixmap_clear(radixmap_t *map);
+
+/**
+ * Return the node that matches the key parameter or a null pointer
+ * if no match can be made.
+ *
+ * @param  map  reference that has been initialized by #radixmap_init
+ * @param  key  null terminated string that names the element
+ * @return pointer to the matching node or null
+ */
+extern radixmapnode_t *radixmap_find(const radixmap_t *map, const char *key);
+
+/**
+ * Same as #radixmap_find with an explicit key length.
+ *
+ * @param  map     reference that has been initialized by #radixmap_init
+ * @param  key     bytes that name the element
+ * @param  keylen  number of bytes in key
+ * @return pointer to the matching node or null
+ */
+extern radixmapnode_t *radixmap_findn(const radixmap_t *map,
+	const char *key, size_t keylen);
+
+/**
+ * Return the first key entry in the map.
+ *
+ * @param  map  reference that has been initialized by #radixmap_init
+ * @return pointer to the first node or null
+ */
+extern radixmapnode_t *radixmap_first(const radixmap_t *map);
+
+/**
+ * Return the last key entry in the map.
+ *
+ * @param  map  reference that has been initialized by #radixmap_init
+ * @return pointer to the last node or null
+ */
+extern radixmapnode_t *radixmap_last(const radixmap_t *map);
+
+/**
+ * Return the next node in key order.
+ *
+ * @param  node  reference to a node stored in the map
+ * @return pointer to the next node or null
+ */
+extern radixmapnode_t *radixmap_next(const radixmapnode_t *node);
+
+/**
+ * Return the previous node in key order.
+ *
+ * @param  node  reference to a node stored in the map
+ * @return pointer to the previous node or null
+ */
+extern radixmapnode_t *radixmap_prev(const radixmapnode_t *node);
+
+/**
+ * Locate the nodes whose key starts with the prefix. All of them are
+ * in the single subtree below the prefix, so the range is found with
+ * one descent and the nodes from first to last (inclusive, following
+ * #radixmap_next) are the matches.
+ *
+ * @param  map     reference that has been initialized by #radixmap_init
+ * @param  prefix  null terminated key prefix
+ * @param  first   set to the first matching node
+ * @param  last    set to the last matching node
+ * @return zero on success, ENOENT if no key has the prefix
+ */
+extern int radixmap_prefix(const radixmap_t *map, const char *prefix,
+	radixmapnode_t **first, radixmapnode_t **last);
+
+/**
+ * Call the callback for every node whose key starts with the prefix
+ * in key order.
+ *
+ * @param  map     reference that has been initialized by #radixmap_init
+ * @param  prefix  null terminated key prefix
+ * @param  cb      function called for every match
+ * @param  ctx     opaque pointer passed to cb
+ * @return zero or the first non-zero value from cb
+ */
+extern int radixmap_walk_prefix(const radixmap_t *map, const char *prefix,
+	radixmap_walk_t cb, void *ctx);
+
+__END_DECLS
@@ -0,0 +1,854 @@
+/*
+ * Copyright (c) 2012-2023  Charles Hardin <ckhardin@gmail.com>
+ * All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/**
+ * @file durablemap.c
+ *
+ * Write ahead log for an ordered map. A record is
+ *
+ *   crc32 | length | type | key length | value length | key | value
+ *
+ * with little endian 32 bit integers and the crc covering everything
+ * after itself. A snapshot is the same records, a put for every key.
+ *
+ * Writers append under the map lock and then wait for their record to
+ * be synced. The first writer to find no sync in progress becomes the
+ * leader and syncs everything appended so far with the lock dropped,
+ * so the writers that queued up meanwhile share its fsync.
+ *
+ * Compaction renames the log to .log.old, starts a new log and writes
+ * a snapshot of the live map in chunks, so writers are only held up
+ * while one chunk is copied. Replaying a put or erase on top of a
+ * state that already has it is harmless, so the snapshot does not
+ * need to be of a single moment and a crash at any step recovers by
+ * replaying snapshot, old log and log.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <assert.h>
+
+#include <libcmap/durablemap.h>
+
+#include "orderedmap_impl.h"
+
+#define DM_REC_PUT	1
+#define DM_REC_DEL	2
+
+#define DM_HDRSZ	8	/* crc and length */
+#define DM_BODYSZ	9	/* type, key length and value length */
+#define DM_SNAPBUFSZ	(64 * 1024)
+
+static pthread_once_t _durablemap_crconce = PTHREAD_ONCE_INIT;
+static uint32_t _durablemap_crctab[256];
+
+
+static void
+_durablemap_crcinit(void)
+{
+	uint32_t i, j, c;
+
+	for (i = 0; i < 256; i++) {
+		c = i;
+		for (j = 0; j < 8; j++)
+			c = (c & 1) ? 0xedb88320U ^ (c >> 1) : c >> 1;
+		_durablemap_crctab[i] = c;
+	}
+}
+
+
+static uint32_t
+_durablemap_crc32(const unsigned char *buf, size_t len)
+{
+	uint32_t crc;
+	size_t i;
+
+	pthread_once(&_durablemap_crconce, _durablemap_crcinit);
+	crc = 0xffffffffU;
+	for (i = 0; i < len; i++)
+		crc = _durablemap_crctab[(crc ^ buf[i]) & 0xff] ^ (crc >> 8);
+	return crc ^ 0xffffffffU;
+}
+
+
+static void
+_durablemap_put32(unsigned char *buf, uint32_t v)
+{
+	buf[0] = v;
+	buf[1] = v >> 8;
+	buf[2] = v >> 16;
+	buf[3] = v >> 24;
+}
+
+
+static uint32_t
+_durablemap_get32(const unsigned char *buf)
+{
+	return (uint32_t)buf[0] | (uint32_t)buf[1] << 8 |
+	       (uint32_t)buf[2] << 16 | (uint32_t)buf[3] << 24;
+}
+
+
+/* encode a record into buf, which must hold the returned size */
+static size_t
+_durablemap_encode(unsigned char *buf, int type, const char *key,
+		   size_t keylen, const char *val, size_t vallen)
+{
+	size_t len;
+
+	len = DM_BODYSZ + keylen + vallen;
+	_durablemap_put32(&buf[4], len);
+	buf[8] = type;
+	_durablemap_put32(&buf[9], keylen);
+	_durablemap_put32(&buf[13], vallen);
+	memcpy(&buf[DM_HDRSZ + DM_BODYSZ], key, keylen);
+	if (vallen != 0)
+		memcpy(&buf[DM_HDRSZ + DM_BODYSZ + keylen], val, vallen);
+	_durablemap_put32(buf, _durablemap_crc32(&buf[4], 4 + len));
+	return DM_HDRSZ + len;
+}
+
+
+static char *
+_durablemap_path(const durablemap_t *dm, const char *suffix)
+{
+	size_t len;
+	char *path;
+
+	len = strlen(dm->dm_path) + strlen(suffix) + 1;
+	path = malloc(len);
+	if (path != NULL)
+		snprintf(path, len, "%s%s", dm->dm_path, suffix);
+	return path;
+}
+
+
+static int
+_durablemap_syncdir(const durablemap_t *dm)
+{
+	int fd, err;
+	char *dir, *slash;
+
+	dir = strdup(dm->dm_path);
+	if (dir == NULL)
+		return ENOMEM;
+	slash = strrchr(dir, '/');
+	if (slash == NULL)
+		strcpy(dir, ".");
+	else if (slash == dir)
+		slash[1] = '\0';
+	else
+		*slash = '\0';
+
+	err = 0;
+	fd = open(dir, O_RDONLY);
+	if (fd < 0 || fsync(fd) != 0)
+		err = errno;
+	if (fd >= 0)
+		close(fd);
+	free(dir);
+	return err;
+}
+
+
+static int
+_durablemap_writeall(int fd, const unsigned char *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len != 0) {
+		n = write(fd, buf, len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return errno;
+		}
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+
+static int
+_durablemap_apply(orderedmap_t *map, int type, const char *key,
+		  size_t keylen, const char *val, size_t vallen)
+{
+	struct orderedmapnode *node;
+
+	node = orderedmap_findn(map, key, keylen);
+	if (type == DM_REC_DEL) {
+		if (node != NULL)
+			orderedmap_erase_node(map, node);
+		return 0;
+	}
+	if (node != NULL)
+		return _orderedmap_setval(map, &node, val, vallen);
+	return orderedmap_insertn(map, key, keylen, val, vallen);
+}
+
+
+/* return the length of the valid record at rec or zero */
+static size_t
+_durablemap_checkrec(const unsigned char *rec, size_t avail)
+{
+	size_t len, keylen, vallen;
+
+	if (avail < DM_HDRSZ)
+		return 0;
+	len = _durablemap_get32(&rec[4]);
+	if (len < DM_BODYSZ || len > avail - DM_HDRSZ)
+		return 0;
+	if (_durablemap_crc32(&rec[4], 4 + len) != _durablemap_get32(rec))
+		return 0;
+
+	keylen = _durablemap_get32(&rec[9]);
+	vallen = _durablemap_get32(&rec[13]);
+	if (DM_BODYSZ + keylen + vallen != len ||
+	    (rec[8] != DM_REC_PUT && rec[8] != DM_REC_DEL))
+		return 0;
+	return DM_HDRSZ + len;
+}
+
+
+/*
+ * A crash during an append leaves a short header, or zeros where the
+ * file grew but the data never landed. A committed record never has
+ * an all zero body since its type is nonzero, so a bad record with
+ * anything but zeros after its header is corruption, even when its
+ * length runs to the end of the file.
+ */
+static bool
+_durablemap_torn(const unsigned char *rec, size_t avail)
+{
+	size_t i;
+
+	for (i = DM_HDRSZ; i < avail; i++) {
+		if (rec[i] != 0)
+			return false;
+	}
+	return true;
+}
+
+
+/*
+ * Apply the records of a file to the map. Only the active log may end
+ * in a torn record, which is left out of the valid length returned so
+ * it can be cut off. Any other bad record fails with EIO.
+ */
+static int
+_durablemap_replay(orderedmap_t *map, const char *path, bool active,
+		   off_t *validp)
+{
+	int fd, err;
+	off_t off;
+	ssize_t n;
+	size_t size, len, keylen, vallen;
+	struct stat st;
+	unsigned char *buf, *rec;
+
+	*validp = 0;
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return errno;
+	if (fstat(fd, &st) != 0) {
+		err = errno;
+		close(fd);
+		return err;
+	}
+
+	size = st.st_size;
+	buf = malloc(size ? size : 1);
+	if (buf == NULL) {
+		close(fd);
+		return ENOMEM;
+	}
+	for (len = 0; len < size; len += n) {
+		n = read(fd, &buf[len], size - len);
+		if (n < 0 && errno == EINTR) {
+			n = 0;
+			continue;
+		}
+		if (n <= 0)
+			break;
+	}
+	close(fd);
+	if (len != size) {
+		free(buf);
+		return EIO;
+	}
+
+	err = 0;
+	off = 0;
+	while ((size_t)off < size) {
+		rec = &buf[off];
+		len = _durablemap_checkrec(rec, size - off);
+		if (len == 0) {
+			if (!active || !_durablemap_torn(rec, size - off))
+				err = EIO;
+			break;
+		}
+
+		keylen = _durablemap_get32(&rec[9]);
+		vallen = _durablemap_get32(&rec[13]);
+		rec = &rec[DM_HDRSZ + DM_BODYSZ];
+		err = _durablemap_apply(map, buf[off + 8], (char *)rec, keylen,
+					(char *)&rec[keylen], vallen);
+		if (err != 0)
+			break;
+		off += len;
+	}
+	free(buf);
+	*validp = off;
+	return err;
+}
+
+
+/* wait until the record at lsn is on disk, called with dm_lock held */
+static int
+_durablemap_waitsync(durablemap_t *dm, uint64_t lsn)
+{
+	int fd, err;
+	uint64_t target;
+
+	while (dm->dm_synclsn < lsn) {
+		if (dm->dm_error != 0)
+			return dm->dm_error;
+		if (dm->dm_syncing) {
+			pthread_cond_wait(&dm->dm_synced, &dm->dm_lock);
+			continue;
+		}
+
+		/* become the leader for everything appended so far */
+		dm->dm_syncing = true;
+		target = dm->dm_lsn;
+		fd = dm->dm_fd;
+		pthread_mutex_unlock(&dm->dm_lock);
+		err = fdatasync(fd) != 0 ? errno : 0;
+		pthread_mutex_lock(&dm->dm_lock);
+
+		dm->dm_syncing = false;
+		if (err != 0)
+			dm->dm_error = err;
+		else if (target > dm->dm_synclsn)
+			dm->dm_synclsn = target;
+		pthread_cond_broadcast(&dm->dm_synced);
+	}
+	return 0;
+}
+
+
+/* start a new log, called with dm_lock held */
+static int
+_durablemap_rotate(durablemap_t *dm, const char *logpath,
+		   const char *oldpath)
+{
+	int fd, err;
+
+	while (dm->dm_syncing)
+		pthread_cond_wait(&dm->dm_synced, &dm->dm_lock);
+	if (fdatasync(dm->dm_fd) != 0)
+		return errno;
+	dm->dm_synclsn = dm->dm_lsn;
+	pthread_cond_broadcast(&dm->dm_synced);
+
+	if (rename(logpath, oldpath) != 0)
+		return errno;
+	fd = open(logpath, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+	if (fd < 0) {
+		err = errno;
+		rename(oldpath, logpath);
+		return err;
+	}
+	err = _durablemap_syncdir(dm);
+	if (err != 0) {
+		close(fd);
+		rename(oldpath, logpath);
+		return err;
+	}
+
+	close(dm->dm_fd);
+	dm->dm_fd = fd;
+	dm->dm_logsize = 0;
+	return 0;
+}
+
+
+/* first node with a key after the given one, which may be gone */
+static struct orderedmapnode *
+_durablemap_after(const orderedmap_t *map, const char *key, size_t keylen)
+{
+	int dir;
+	struct orderedmapnode *node;
+	struct orderedmapnode *parent;
+
+	node = _orderedmap_lookup(map, key, keylen, &parent, &dir);
+	if (node != NULL)
+		return orderedmap_next(node);
+	if (parent == NULL || dir == 0)
+		return parent;
+	return orderedmap_next(parent);
+}
+
+
+/*
+ * Write a snapshot of the live map a chunk at a time. A chunk is
+ * encoded with dm_lock held and written with it dropped, and the next
+ * one resumes after the last key copied, so writers only wait for one
+ * chunk. The keys changed meanwhile are all in the log that was
+ * started before the first chunk, and replaying it over the snapshot
+ * gives their latest value. The snapshot only goes into place once
+ * the log is synced past every change it copied.
+ */
+static int
+_durablemap_writesnap(durablemap_t *dm)
+{
+	int fd, err;
+	bool started, done;
+	size_t len, need, bufsz, lastlen;
+	uint64_t lsn;
+	char *tmppath, *snappath, *last, *kptr;
+	unsigned char *buf, *rec;
+	struct orderedmapnode *node;
+	struct orderedmapnode *prev;
+
+	tmppath = _durablemap_path(dm, ".snap.tmp");
+	snappath = _durablemap_path(dm, ".snap");
+	bufsz = DM_SNAPBUFSZ;
+	buf = malloc(bufsz);
+	last = NULL;
+	if (tmppath == NULL || snappath == NULL || buf == NULL) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	fd = open(tmppath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		err = errno;
+		goto out;
+	}
+
+	err = 0;
+	started = false;
+	done = false;
+	lastlen = 0;
+	lsn = 0;
+	while (err == 0 && !done) {
+		len = 0;
+		prev = NULL;
+		pthread_mutex_lock(&dm->dm_lock);
+		node = started ? _durablemap_after(&dm->dm_map, last, lastlen) :
+				 orderedmap_first(&dm->dm_map);
+		for (; node != NULL; node = orderedmap_next(node)) {
+			need = DM_HDRSZ + DM_BODYSZ + node->omn_keylen +
+			       node->omn_vallen;
+			if (len + need > bufsz) {
+				if (len != 0)
+					break;
+				/* a large record is a chunk of its own */
+				rec = realloc(buf, need);
+				if (rec == NULL) {
+					err = ENOMEM;
+					break;
+				}
+				buf = rec;
+				bufsz = need;
+			}
+			len += _durablemap_encode(&buf[len], DM_REC_PUT,
+						  node->omn_key,
+						  node->omn_keylen,
+						  node->omn_val,
+						  node->omn_vallen);
+			prev = node;
+		}
+		if (err == 0 && prev != NULL) {
+			/* the node may be gone by the next chunk, keep the key */
+			kptr = realloc(last, prev->omn_keylen + 1);
+			if (kptr == NULL)
+				err = ENOMEM;
+			else {
+				memcpy(kptr, prev->omn_key, prev->omn_keylen);
+				last = kptr;
+				lastlen = prev->omn_keylen;
+				started = true;
+			}
+		}
+		done = node == NULL;
+		lsn = dm->dm_lsn;
+		pthread_mutex_unlock(&dm->dm_lock);
+
+		if (err == 0)
+			err = _durablemap_writeall(fd, buf, len);
+	}
+
+	if (err == 0) {
+		pthread_mutex_lock(&dm->dm_lock);
+		err = _durablemap_waitsync(dm, lsn);
+		pthread_mutex_unlock(&dm->dm_lock);
+	}
+	if (err == 0 && fsync(fd) != 0)
+		err = errno;
+	close(fd);
+
+	if (err == 0 && rename(tmppath, snappath) != 0)
+		err = errno;
+	if (err == 0)
+		err = _durablemap_syncdir(dm);
+	if (err != 0)
+		unlink(tmppath);
+
+ out:
+	free(last);
+	free(buf);
+	free(snappath);
+	free(tmppath);
+	return err;
+}
+
+
+/* called with dm_compactlock held */
+static int
+_durablemap_compact(durablemap_t *dm)
+{
+	int err;
+	char *logpath, *oldpath;
+
+	logpath = _durablemap_path(dm, ".log");
+	oldpath = _durablemap_path(dm, ".log.old");
+	if (logpath == NULL || oldpath == NULL) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	pthread_mutex_lock(&dm->dm_lock);
+	dm->dm_compactreq = false;
+
+	/*
+	 * An old log left by a failed compaction is still covered by
+	 * the snapshot taken now, so it is enough to replace it.
+	 */
+	err = 0;
+	if (access(oldpath, F_OK) != 0)
+		err = _durablemap_rotate(dm, logpath, oldpath);
+	pthread_mutex_unlock(&dm->dm_lock);
+
+	if (err == 0)
+		err = _durablemap_writesnap(dm);
+	if (err == 0 && unlink(oldpath) == 0)
+		err = _durablemap_syncdir(dm);
+
+ out:
+	free(oldpath);
+	free(logpath);
+	return err;
+}
+
+
+static void *
+_durablemap_thread(void *arg)
+{
+	durablemap_t *dm = arg;
+
+	pthread_mutex_lock(&dm->dm_lock);
+	for (;;) {
+		while (!dm->dm_closing && !dm->dm_compactreq)
+			pthread_cond_wait(&dm->dm_work, &dm->dm_lock);
+		if (dm->dm_closing)
+			break;
+		pthread_mutex_unlock(&dm->dm_lock);
+
+		/* a failure is retried once the log grows again */
+		pthread_mutex_lock(&dm->dm_compactlock);
+		_durablemap_compact(dm);
+		pthread_mutex_unlock(&dm->dm_compactlock);
+
+		pthread_mutex_lock(&dm->dm_lock);
+	}
+	pthread_mutex_unlock(&dm->dm_lock);
+	return NULL;
+}
+
+
+static int
+_durablemap_change(durablemap_t *dm, int type, bool excl,
+		   const char *key, const char *val)
+{
+	int err;
+	uint64_t lsn;
+	size_t keylen, vallen, reclen;
+	unsigned char *rec;
+	struct orderedmapnode *node;
+
+	if (!dm || !key || (type == DM_REC_PUT && !val))
+		return EINVAL;
+
+	keylen = strlen(key);
+	vallen = val ? strlen(val) : 0;
+	if (keylen > UINT32_MAX || vallen > UINT32_MAX - DM_BODYSZ - keylen)
+		return E2BIG;
+
+	/* build the record before taking the lock */
+	rec = malloc(DM_HDRSZ + DM_BODYSZ + keylen + vallen);
+	if (rec == NULL)
+		return ENOMEM;
+	reclen = _durablemap_encode(rec, type, key, keylen, val, vallen);
+
+	pthread_mutex_lock(&dm->dm_lock);
+	err = dm->dm_error;
+	if (err != 0)
+		goto out;
+
+	node = orderedmap_findn(&dm->dm_map, key, keylen);
+	if (type == DM_REC_PUT && excl && node != NULL) {
+		err = EPERM;
+		goto out;
+	}
+	if (type == DM_REC_DEL && node == NULL) {
+		err = ENOENT;
+		goto out;
+	}
+
+	err = _durablemap_writeall(dm->dm_fd, rec, reclen);
+	if (err != 0) {
+		/* drop a partial record so the log stays parseable */
+		if (ftruncate(dm->dm_fd, dm->dm_logsize) != 0)
+			dm->dm_error = err;
+		goto out;
+	}
+	dm->dm_logsize += reclen;
+
+	/* the log has the change now, the map must follow */
+	err = _durablemap_apply(&dm->dm_map, type, key, keylen, val, vallen);
+	if (err != 0) {
+		dm->dm_error = err;
+		goto out;
+	}
+
+	lsn = ++dm->dm_lsn;
+	err = _durablemap_waitsync(dm, lsn);
+	if (err == 0 && dm->dm_logsize >= dm->dm_compactsize &&
+	    !dm->dm_compactreq) {
+		dm->dm_compactreq = true;
+		pthread_cond_signal(&dm->dm_work);
+	}
+
+ out:
+	pthread_mutex_unlock(&dm->dm_lock);
+	free(rec);
+	return err;
+}
+
+
+int
+durablemap_open(durablemap_t *dm, const char *path, size_t compactsize)
+{
+	int err;
+	off_t valid;
+	char *snappath, *logpath, *oldpath;
+	bool hasold;
+
+	if (!dm || !path)
+		return EINVAL;
+
+	memset(dm, 0, sizeof(*dm));
+	dm->dm_fd = -1;
+	dm->dm_compactsize = compactsize ? compactsize :
+				DURABLEMAP_COMPACTSIZE;
+	orderedmap_init(&dm->dm_map);
+	dm->dm_path = strdup(path);
+	snappath = _durablemap_path(dm, ".snap");
+	logpath = _durablemap_path(dm, ".log");
+	oldpath = _durablemap_path(dm, ".log.old");
+	if (dm->dm_path == NULL || snappath == NULL || logpath == NULL ||
+	    oldpath == NULL) {
+		err = ENOMEM;
+		goto fail;
+	}
+
+	/*
+	 * A snapshot is only renamed into place once complete and an old
+	 * log was synced before it was rotated, so both have to replay to
+	 * the end. The old log stays until a snapshot covers it.
+	 */
+	err = _durablemap_replay(&dm->dm_map, snappath, false, &valid);
+	if (err != 0 && err != ENOENT)
+		goto fail;
+
+	err = _durablemap_replay(&dm->dm_map, oldpath, false, &valid);
+	hasold = err != ENOENT;
+	if (err != 0 && err != ENOENT)
+		goto fail;
+
+	/* cut off a record torn by a crash during append */
+	err = _durablemap_replay(&dm->dm_map, logpath, true, &valid);
+	if (err != 0 && err != ENOENT)
+		goto fail;
+	dm->dm_fd = open(logpath, O_WRONLY | O_CREAT | O_APPEND, 0644);
+	if (dm->dm_fd < 0 || ftruncate(dm->dm_fd, valid) != 0) {
+		err = errno;
+		goto fail;
+	}
+	dm->dm_logsize = valid;
+
+	/* a new log has to be in the directory before records go in it */
+	if (err == ENOENT) {
+		err = _durablemap_syncdir(dm);
+		if (err != 0)
+			goto fail;
+	}
+
+	pthread_mutex_init(&dm->dm_lock, NULL);
+	pthread_mutex_init(&dm->dm_compactlock, NULL);
+	pthread_cond_init(&dm->dm_synced, NULL);
+	pthread_cond_init(&dm->dm_work, NULL);
+
+	/* finish the compaction that was interrupted */
+	if (hasold) {
+		err = _durablemap_compact(dm);
+		if (err != 0)
+			goto faillocks;
+	}
+
+	err = pthread_create(&dm->dm_thread, NULL, _durablemap_thread, dm);
+	if (err != 0)
+		goto faillocks;
+
+	free(oldpath);
+	free(logpath);
+	free(snappath);
+	return 0;
+
+ faillocks:
+	pthread_cond_destroy(&dm->dm_work);
+	pthread_cond_destroy(&dm->dm_synced);
+	pthread_mutex_destroy(&dm->dm_compactlock);
+	pthread_mutex_destroy(&dm->dm_lock);
+ fail:
+	if (dm->dm_fd >= 0)
+		close(dm->dm_fd);
+	orderedmap_destroy(&dm->dm_map);
+	free(oldpath);
+	free(logpath);
+	free(snappath);
+	free(dm->dm_path);
+	dm->dm_path = NULL;
+	return err;
+}
+
+
+int
+durablemap_close(durablemap_t *dm)
+{
+	int err;
+
+	if (!dm || !dm->dm_path)
+		return EINVAL;
+
+	pthread_mutex_lock(&dm->dm_lock);
+	dm->dm_closing = true;
+	pthread_cond_signal(&dm->dm_work);
+	pthread_mutex_unlock(&dm->dm_lock);
+	pthread_join(dm->dm_thread, NULL);
+
+	err = dm->dm_error;
+	if (fdatasync(dm->dm_fd) != 0 && err == 0)
+		err = errno;
+	close(dm->dm_fd);
+	dm->dm_fd = -1;
+
+	pthread_cond_destroy(&dm->dm_work);
+	pthread_cond_destroy(&dm->dm_synced);
+	pthread_mutex_destroy(&dm->dm_compactlock);
+	pthread_mutex_destroy(&dm->dm_lock);
+	orderedmap_destroy(&dm->dm_map);
+	free(dm->dm_path);
+	dm->dm_path = NULL;
+	return err;
+}
+
+
+int
+durablemap_insert(durablemap_t *dm, const char *key, const void *val)
+{
+	return _durablemap_change(dm, DM_REC_PUT, true, key, val);
+}
+
+
+int
+durablemap_set(durablemap_t *dm, const char *key, const void *val)
+{
+	return _durablemap_change(dm, DM_REC_PUT, false, key, val);
+}
+
+
+int
+durablemap_erase(durablemap_t *dm, const char *key)
+{
+	return _durablemap_change(dm, DM_REC_DEL, false, key, NULL);
+}
+
+
+int
+durablemap_compact(durablemap_t *dm)
+{
+	int err;
+
+	if (!dm)
+		return EINVAL;
+
+	pthread_mutex_lock(&dm->dm_compactlock);
+	err = _durablemap_compact(dm);
+	pthread_mutex_unlock(&dm->dm_compactlock);
+	return err;
+}
+
+
+void
+durablemap_lock(durablemap_t *dm)
+{
+	pthread_mutex_lock(&dm->dm_lock);
+}
+
+
+void
+durablemap_unlock(durablemap_t *dm)
+{
+	pthread_mutex_unlock(&dm->dm_lock);
+}
+
+
+const orderedmap_t *
+durablemap_map(const durablemap_t *dm)
+{
+	if (!dm)
+		return NULL;
+	return &dm->dm_map;
+}
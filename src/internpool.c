@@ -0,0 +1,285 @@
+/*
+ * Copyright (c) 2012-2023  Charles Hardin <ckhardin@gmail.com>
+ * All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/**
+ * @file internpool.c
+ *
+ * Sharded, reference counted string intern pool. Each shard is a
+ * chained hash table under its own lock, the entries carry the
+ * string bytes in their tail and the handle given out is the
+ * address of those bytes.
+ */
+
+#include <sys/types.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+
+#include <libcmap/internpool.h>
+
+#define INTERNPOOL_MINBUCKETS	64
+
+struct internpoolentry {
+	struct internpoolentry *ipe_next;
+	uint64_t ipe_hash;
+	size_t ipe_refcnt;
+	size_t ipe_len;
+	char ipe_str[];
+};
+
+
+static uint64_t
+_internpool_hash(const char *str, size_t len)
+{
+	uint64_t hash;
+	size_t i;
+
+	/* FNV-1a */
+	hash = 0xcbf29ce484222325ULL;
+	for (i = 0; i < len; i++) {
+		hash ^= (unsigned char)str[i];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+
+static struct internpoolshard *
+_internpool_shard(internpool_t *pool, uint64_t hash)
+{
+	/* the low bits pick the bucket, so use the high bits here */
+	return &pool->ip_shards[(hash >> 60) % INTERNPOOL_NUMSHARDS];
+}
+
+
+static struct internpoolentry *
+_internpool_entry(const char *handle)
+{
+	return (struct internpoolentry *)
+		(uintptr_t)(handle - offsetof(struct internpoolentry, ipe_str));
+}
+
+
+static int
+_internpool_grow(struct internpoolshard *shard)
+{
+	size_t i, nbuckets;
+	struct internpoolentry **buckets;
+	struct internpoolentry *ent, *next;
+
+	nbuckets = shard->ips_numbuckets * 2;
+	if (nbuckets < INTERNPOOL_MINBUCKETS)
+		nbuckets = INTERNPOOL_MINBUCKETS;
+	buckets = calloc(nbuckets, sizeof(*buckets));
+	if (buckets == NULL)
+		return ENOMEM;
+
+	for (i = 0; i < shard->ips_numbuckets; i++) {
+		for (ent = shard->ips_buckets[i]; ent != NULL; ent = next) {
+			next = ent->ipe_next;
+			ent->ipe_next = buckets[ent->ipe_hash & (nbuckets - 1)];
+			buckets[ent->ipe_hash & (nbuckets - 1)] = ent;
+		}
+	}
+	free(shard->ips_buckets);
+	shard->ips_buckets = buckets;
+	shard->ips_numbuckets = nbuckets;
+	return 0;
+}
+
+
+int
+internpool_init(internpool_t *pool)
+{
+	int i, err;
+	struct internpoolshard *shard;
+
+	if (!pool)
+		return EINVAL;
+
+	for (i = 0; i < INTERNPOOL_NUMSHARDS; i++) {
+		shard = &pool->ip_shards[i];
+		err = pthread_mutex_init(&shard->ips_lock, NULL);
+		if (err != 0) {
+			while (--i >= 0)
+				pthread_mutex_destroy(
+					&pool->ip_shards[i].ips_lock);
+			return err;
+		}
+		shard->ips_numentries = 0;
+		shard->ips_numbuckets = 0;
+		shard->ips_buckets = NULL;
+	}
+	return 0;
+}
+
+
+int
+internpool_destroy(internpool_t *pool)
+{
+	int i;
+	struct internpoolshard *shard;
+
+	if (!pool)
+		return EINVAL;
+
+	if (internpool_count(pool) != 0)
+		return EBUSY;
+
+	for (i = 0; i < INTERNPOOL_NUMSHARDS; i++) {
+		shard = &pool->ip_shards[i];
+		free(shard->ips_buckets);
+		shard->ips_buckets = NULL;
+		shard->ips_numbuckets = 0;
+		pthread_mutex_destroy(&shard->ips_lock);
+	}
+	return 0;
+}
+
+
+const char *
+internpool_intern(internpool_t *pool, const char *str, size_t len)
+{
+	uint64_t hash;
+	struct internpoolshard *shard;
+	struct internpoolentry **bucket;
+	struct internpoolentry *ent;
+
+	if (!pool || !str)
+		return NULL;
+
+	hash = _internpool_hash(str, len);
+	shard = _internpool_shard(pool, hash);
+	pthread_mutex_lock(&shard->ips_lock);
+
+	if (shard->ips_numbuckets != 0) {
+		bucket = &shard->ips_buckets[hash &
+					     (shard->ips_numbuckets - 1)];
+		for (ent = *bucket; ent != NULL; ent = ent->ipe_next) {
+			if (ent->ipe_hash == hash && ent->ipe_len == len &&
+			    memcmp(ent->ipe_str, str, len) == 0) {
+				ent->ipe_refcnt++;
+				pthread_mutex_unlock(&shard->ips_lock);
+				return ent->ipe_str;
+			}
+		}
+	}
+
+	/* keep the load factor at or below one */
+	if (shard->ips_numentries >= shard->ips_numbuckets &&
+	    _internpool_grow(shard) != 0) {
+		pthread_mutex_unlock(&shard->ips_lock);
+		return NULL;
+	}
+
+	ent = malloc(sizeof(*ent) + len + 1);
+	if (ent == NULL) {
+		pthread_mutex_unlock(&shard->ips_lock);
+		return NULL;
+	}
+	ent->ipe_hash = hash;
+	ent->ipe_refcnt = 1;
+	ent->ipe_len = len;
+	memcpy(ent->ipe_str, str, len);
+	ent->ipe_str[len] = '\0';
+
+	bucket = &shard->ips_buckets[hash & (shard->ips_numbuckets - 1)];
+	ent->ipe_next = *bucket;
+	*bucket = ent;
+	shard->ips_numentries++;
+
+	pthread_mutex_unlock(&shard->ips_lock);
+	return ent->ipe_str;
+}
+
+
+void
+internpool_retain(internpool_t *pool, const char *handle)
+{
+	struct internpoolentry *ent;
+	struct internpoolshard *shard;
+
+	if (!pool || !handle)
+		return;
+
+	ent = _internpool_entry(handle);
+	shard = _internpool_shard(pool, ent->ipe_hash);
+	pthread_mutex_lock(&shard->ips_lock);
+	assert(ent->ipe_refcnt > 0);
+	ent->ipe_refcnt++;
+	pthread_mutex_unlock(&shard->ips_lock);
+}
+
+
+void
+internpool_release(internpool_t *pool, const char *handle)
+{
+	struct internpoolentry *ent;
+	struct internpoolentry **pent;
+	struct internpoolshard *shard;
+
+	if (!pool || !handle)
+		return;
+
+	ent = _internpool_entry(handle);
+	shard = _internpool_shard(pool, ent->ipe_hash);
+	pthread_mutex_lock(&shard->ips_lock);
+	assert(ent->ipe_refcnt > 0);
+	if (--ent->ipe_refcnt != 0) {
+		pthread_mutex_unlock(&shard->ips_lock);
+		return;
+	}
+
+	pent = &shard->ips_buckets[ent->ipe_hash &
+				   (shard->ips_numbuckets - 1)];
+	while (*pent != ent)
+		pent = &(*pent)->ipe_next;
+	*pent = ent->ipe_next;
+	shard->ips_numentries--;
+	pthread_mutex_unlock(&shard->ips_lock);
+	free(ent);
+}
+
+
+size_t
+internpool_count(internpool_t *pool)
+{
+	int i;
+	size_t count;
+	struct internpoolshard *shard;
+
+	if (!pool)
+		return 0;
+
+	count = 0;
+	for (i = 0; i < INTERNPOOL_NUMSHARDS; i++) {
+		shard = &pool->ip_shards[i];
+		pthread_mutex_lock(&shard->ips_lock);
+		count += shard->ips_numentries;
+		pthread_mutex_unlock(&shard->ips_lock);
+	}
+	return count;
+}
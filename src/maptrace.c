@@ -0,0 +1,307 @@
+/*
+ * Copyright (c) 2012-2023  Charles Hardin <ckhardin@gmail.com>
+ * All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/**
+ * @file maptrace.c
+ *
+ * The trace starts with an 8 byte magic and is followed by records
+ * of one type byte and unsigned LEB128 numbers:
+ *
+ *   key      0, length, key bytes - defines the next key id
+ *   insert   1, key id, value length
+ *   find     2, key id
+ *   erase    3, key id
+ *   clear    4
+ *
+ * The key definition is written right before the first record that
+ * uses the key, so a repeated key costs two or three bytes.
+ */
+
+#include <sys/types.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <libcmap/maptrace.h>
+
+#define MAPTRACE_MAGIC		"CMAPTRC1"
+#define MAPTRACE_MAGICLEN	8
+#define MAPTRACE_KEY		0
+
+
+static void
+_maptrace_putnum(maptrace_t *trace, uint64_t v)
+{
+	while (v >= 0x80) {
+		putc((int)(v & 0x7f) | 0x80, trace->mt_fp);
+		v >>= 7;
+	}
+	putc((int)v, trace->mt_fp);
+}
+
+
+static int
+_maptrace_getnum(FILE *fp, uint64_t *vp)
+{
+	int c, shift;
+	uint64_t v;
+
+	v = 0;
+	for (shift = 0; shift < 64; shift += 7) {
+		c = getc(fp);
+		if (c == EOF)
+			return EIO;
+		v |= (uint64_t)(c & 0x7f) << shift;
+		if ((c & 0x80) == 0) {
+			*vp = v;
+			return 0;
+		}
+	}
+	return EIO;
+}
+
+
+int
+maptrace_open(maptrace_t *trace, const char *path)
+{
+	if (!trace || !path)
+		return EINVAL;
+
+	memset(trace, 0, sizeof(*trace));
+	trace->mt_fp = fopen(path, "wb");
+	if (trace->mt_fp == NULL)
+		return errno;
+	orderedmap_init(&trace->mt_keys);
+	if (fwrite(MAPTRACE_MAGIC, MAPTRACE_MAGICLEN, 1, trace->mt_fp) != 1)
+		trace->mt_error = errno ? errno : EIO;
+	return 0;
+}
+
+
+int
+maptrace_close(maptrace_t *trace)
+{
+	int err;
+
+	if (!trace || !trace->mt_fp)
+		return EINVAL;
+
+	err = trace->mt_error;
+	if (ferror(trace->mt_fp) && err == 0)
+		err = EIO;
+	if (fclose(trace->mt_fp) != 0 && err == 0)
+		err = errno;
+	trace->mt_fp = NULL;
+	orderedmap_destroy(&trace->mt_keys);
+	return err;
+}
+
+
+void
+maptrace_record(maptrace_t *trace, maptrace_optype_t type,
+		const char *key, size_t keylen, size_t vallen)
+{
+	uint64_t id;
+	orderedmapnode_t *node;
+
+	if (!trace || trace->mt_error != 0)
+		return;
+
+	id = 0;
+	if (type != MAPTRACE_CLEAR) {
+		/* the dictionary holds the id as raw bytes */
+		node = orderedmap_findn(&trace->mt_keys, key, keylen);
+		if (node != NULL)
+			memcpy(&id, node->omn_val, sizeof(id));
+		else {
+			id = trace->mt_numkeys;
+			if (orderedmap_insertn(&trace->mt_keys, key, keylen,
+					       &id, sizeof(id)) != 0) {
+				trace->mt_error = ENOMEM;
+				return;
+			}
+			trace->mt_numkeys++;
+			putc(MAPTRACE_KEY, trace->mt_fp);
+			_maptrace_putnum(trace, keylen);
+			fwrite(key, 1, keylen, trace->mt_fp);
+		}
+	}
+
+	putc(type, trace->mt_fp);
+	if (type != MAPTRACE_CLEAR)
+		_maptrace_putnum(trace, id);
+	if (type == MAPTRACE_INSERT)
+		_maptrace_putnum(trace, vallen);
+	if (ferror(trace->mt_fp))
+		trace->mt_error = EIO;
+	trace->mt_numops++;
+}
+
+
+int
+orderedmap_trace(orderedmap_t *map, maptrace_t *trace)
+{
+	if (!map)
+		return EINVAL;
+
+	map->om_trace = trace;
+	return 0;
+}
+
+
+int
+maptrace_reader_open(maptrace_reader_t *reader, const char *path)
+{
+	char magic[MAPTRACE_MAGICLEN];
+
+	if (!reader || !path)
+		return EINVAL;
+
+	memset(reader, 0, sizeof(*reader));
+	reader->mtr_fp = fopen(path, "rb");
+	if (reader->mtr_fp == NULL)
+		return errno;
+	if (fread(magic, sizeof(magic), 1, reader->mtr_fp) != 1 ||
+	    memcmp(magic, MAPTRACE_MAGIC, sizeof(magic)) != 0) {
+		fclose(reader->mtr_fp);
+		reader->mtr_fp = NULL;
+		return EINVAL;
+	}
+	return 0;
+}
+
+
+int
+maptrace_reader_close(maptrace_reader_t *reader)
+{
+	size_t i;
+
+	if (!reader || !reader->mtr_fp)
+		return EINVAL;
+
+	for (i = 0; i < reader->mtr_numkeys; i++)
+		free(reader->mtr_keys[i]);
+	free(reader->mtr_keys);
+	free(reader->mtr_keylens);
+	fclose(reader->mtr_fp);
+	memset(reader, 0, sizeof(*reader));
+	return 0;
+}
+
+
+static int
+_maptrace_readkey(maptrace_reader_t *reader)
+{
+	uint64_t len;
+	size_t max;
+	char *key;
+	char **keys;
+	size_t *lens;
+	int err;
+
+	err = _maptrace_getnum(reader->mtr_fp, &len);
+	if (err != 0)
+		return err;
+	if (len > SIZE_MAX - 1)
+		return EIO;
+
+	if (reader->mtr_numkeys == reader->mtr_maxkeys) {
+		max = reader->mtr_maxkeys ? reader->mtr_maxkeys * 2 : 64;
+		keys = realloc(reader->mtr_keys, max * sizeof(*keys));
+		if (keys == NULL)
+			return ENOMEM;
+		reader->mtr_keys = keys;
+		lens = realloc(reader->mtr_keylens, max * sizeof(*lens));
+		if (lens == NULL)
+			return ENOMEM;
+		reader->mtr_keylens = lens;
+		reader->mtr_maxkeys = max;
+	}
+
+	key = malloc(len + 1);
+	if (key == NULL)
+		return ENOMEM;
+	if (len != 0 && fread(key, len, 1, reader->mtr_fp) != 1) {
+		free(key);
+		return EIO;
+	}
+	key[len] = '\0';
+	reader->mtr_keys[reader->mtr_numkeys] = key;
+	reader->mtr_keylens[reader->mtr_numkeys] = len;
+	reader->mtr_numkeys++;
+	return 0;
+}
+
+
+int
+maptrace_read(maptrace_reader_t *reader, maptrace_op_t *op)
+{
+	int c, err;
+	uint64_t id, vallen;
+
+	if (!reader || !reader->mtr_fp || !op)
+		return EINVAL;
+
+	while ((c = getc(reader->mtr_fp)) == MAPTRACE_KEY) {
+		err = _maptrace_readkey(reader);
+		if (err != 0)
+			return err;
+	}
+	if (c == EOF)
+		return ferror(reader->mtr_fp) ? EIO : ENOENT;
+
+	memset(op, 0, sizeof(*op));
+	switch (c) {
+	case MAPTRACE_CLEAR:
+		op->mto_type = MAPTRACE_CLEAR;
+		return 0;
+	case MAPTRACE_INSERT:
+	case MAPTRACE_FIND:
+	case MAPTRACE_ERASE:
+		break;
+	default:
+		return EIO;
+	}
+
+	err = _maptrace_getnum(reader->mtr_fp, &id);
+	if (err != 0)
+		return err;
+	if (id >= reader->mtr_numkeys)
+		return EIO;
+	vallen = 0;
+	if (c == MAPTRACE_INSERT) {
+		err = _maptrace_getnum(reader->mtr_fp, &vallen);
+		if (err != 0)
+			return err;
+	}
+
+	op->mto_type = c;
+	op->mto_keyid = id;
+	op->mto_key = reader->mtr_keys[id];
+	op->mto_keylen = reader->mtr_keylens[id];
+	op->mto_vallen = vallen;
+	return 0;
+}
@@ -43,22 +43,157 @@
 #include <assert.h>
 
 #include <libcmap/orderedmap.h>
+#include <libcmap/internpool.h>
+#include <libcmap/maptrace.h>
+
+#include "orderedmap_impl.h"
 
 #ifndef	__DECONST
 #define	__DECONST(type, var)	((type)(uintptr_t)(const void *)(var))
 #endif
 
-struct orderedmapnode {
-	enum {
-		OMN_RED = 0,
-		OMN_BLACK = 1
-	} omn_color;
-	struct orderedmapnode *omn_parent;
-	struct orderedmapnode *omn_child[2]; /* 0 - left and 1 - right */
+static struct orderedmapnode *
+_orderedmap_newnode(struct orderedmap *map, int kind, const char *key,
+		    size_t keysz, const char *val, size_t valsz)
+{
+	size_t sz;
+	struct orderedmapnode *nnew;
+	struct orderedmap *child;
+	const char *handle;
+	char *tail;
+
+	/* the tail holds the table or value, then the key if not pooled */
+	sz = _orderedmap_nodesize(map, kind, keysz, valsz);
+	handle = NULL;
+	if (map->om_pool != NULL) {
+		handle = internpool_intern(map->om_pool, key, keysz);
+		if (handle == NULL)
+			return NULL;
+	}
+
+	child = NULL;
+	if (kind == OMN_MAP)
+		child = malloc(sizeof(*child));
+	nnew = malloc(sz);
+	if (nnew == NULL || (kind == OMN_MAP && child == NULL)) {
+		free(nnew);
+		free(child);
+		if (handle != NULL)
+			internpool_release(map->om_pool, handle);
+		return NULL;
+	}
+	memset(nnew, 0, sizeof(*nnew));
+	nnew->omn_kind = kind;
+
+	tail = (char *)&nnew[1];
+	if (kind == OMN_MAP) {
+		/* a nested table orders and stores keys like its parent */
+		orderedmap_init_cmp(child, map->om_cmp, map->om_cmpctx);
+		child->om_pool = map->om_pool;
+		memcpy(tail, &child, sizeof(child));
+		tail += sizeof(child);
+	} else {
+		memcpy(tail, val, valsz);
+		tail[valsz] = '\0';
+		nnew->omn_vallen = valsz;
+		nnew->omn_val = tail;
+		tail += valsz + 1;
+	}
+
+	if (handle == NULL) {
+		memcpy(tail, key, keysz);
+		tail[keysz] = '\0';
+		handle = tail;
+	}
+	nnew->omn_keylen = keysz;
+	nnew->omn_key = handle;
+	return nnew;
+}
+
+
+static void
+_orderedmap_freenode(struct orderedmap *map, struct orderedmapnode *node)
+{
+	struct orderedmap *child;
+
+	if (node->omn_kind == OMN_MAP) {
+		child = orderedmap_getmap(node);
+		orderedmap_destroy(child);
+		free(child);
+	}
+	if (map->om_pool != NULL)
+		internpool_release(map->om_pool, node->omn_key);
+	if (node->omn_block != NULL)
+		_orderedmap_blockput(map, node->omn_block);
+	else
+		free(node);
+}
+
+
+/*
+ * Put a new node in the place of an old one in the tree, taking over
+ * its color and links. The old node is unlinked but not freed.
+ */
+void
+_orderedmap_swapnode(struct orderedmap *map, struct orderedmapnode *old,
+		     struct orderedmapnode *nnew)
+{
+	struct orderedmapnode *p;
+
+	nnew->omn_color = old->omn_color;
+	nnew->omn_parent = p = old->omn_parent;
+	nnew->omn_child[0] = old->omn_child[0];
+	nnew->omn_child[1] = old->omn_child[1];
+	if (map->om_last == old)
+		map->om_last = nnew;
+	if (map->om_compactnext == old)
+		map->om_compactnext = nnew;
+	if (p != NULL)
+		p->omn_child[old == p->omn_child[1]] = nnew;
+	else
+		map->om_root = nnew;
+	if (nnew->omn_child[0] != NULL)
+		nnew->omn_child[0]->omn_parent = nnew;
+	if (nnew->omn_child[1] != NULL)
+		nnew->omn_child[1]->omn_parent = nnew;
+}
+
+
+int
+_orderedmap_setval(struct orderedmap *map, struct orderedmapnode **nodep,
+		   const char *val, size_t vallen)
+{
+	struct orderedmapnode *node;
+	struct orderedmapnode *nnew;
+	char *vptr;
+
+	/* a replay has no in place set, it does the same work this way */
+	node = *nodep;
+	if (map->om_trace != NULL) {
+		maptrace_record(map->om_trace, MAPTRACE_ERASE, node->omn_key,
+				node->omn_keylen, 0);
+		maptrace_record(map->om_trace, MAPTRACE_INSERT, node->omn_key,
+				node->omn_keylen, vallen);
+	}
+	if (node->omn_kind == OMN_STRING && !node->omn_borrowed &&
+	    vallen <= node->omn_vallen) {
+		/* a value that fits is rewritten in the node */
+		vptr = __DECONST(char *, node->omn_val);
+		memcpy(vptr, val, vallen);
+		vptr[vallen] = '\0';
+		node->omn_vallen = vallen;
+		return 0;
+	}
 
-	const char *omn_key;
-	const char *omn_val;
-};
+	nnew = _orderedmap_newnode(map, OMN_STRING, node->omn_key,
+				   node->omn_keylen, val, vallen);
+	if (nnew == NULL)
+		return ENOMEM;
+	_orderedmap_swapnode(map, node, nnew);
+	_orderedmap_freenode(map, node);
+	*nodep = nnew;
+	return 0;
+}
 
 
 static bool
@@ -118,7 +253,7 @@ _orderedmap_fixup(struct orderedmap *map,
 		o = p->omn_child[dir];
 		if (_orderedmap_isred(o)) {
 			o->omn_color = OMN_BLACK;
-			o->omn_color = OMN_RED;
+			p->omn_color = OMN_RED;
 			_orderedmap_rotate(map, p, !dir); /* rotate otherway */
 			o = p->omn_child[dir];
 		}
@@ -153,13 +288,18 @@ _orderedmap_fixup(struct orderedmap *map,
 }
 
 
-static void
+void
 _orderedmap_remove(struct orderedmap *map, struct orderedmapnode *node)
 {
 	int color;
 	struct orderedmapnode *p;
 	struct orderedmapnode *c;
 
+	if (node == map->om_last)
+		map->om_last = orderedmap_prev(node);
+	if (node == map->om_compactnext)
+		map->om_compactnext = orderedmap_next(node);
+
 	if (node->omn_child[0] == NULL)
 		c = node->omn_child[1]; /* use right */
 	else if (node->omn_child[1] == NULL)
@@ -225,101 +365,56 @@ _orderedmap_remove(struct orderedmap *map, struct orderedmapnode *node)
 }
 
 
-int
-orderedmap_init(orderedmap_t *map)
+struct orderedmapnode *
+_orderedmap_lookup(const struct orderedmap *map, const char *key,
+		   size_t keylen, struct orderedmapnode **parentp, int *dirp)
 {
-	if (!map)
-		return EINVAL;
-
-	map->om_numnodes = 0;
-	map->om_root = NULL;
-	return 0;
-}
-
+	int cmp, dir;
+	struct orderedmapnode *p;
+	struct orderedmapnode *node;
 
-int
-orderedmap_destroy(orderedmap_t *map)
-{
-	int err;
+	p = NULL;
+	dir = 0;
+	node = map->om_root;
+	while (node != NULL) {
+		cmp = _orderedmap_cmp(map, key, keylen,
+				      node->omn_key, node->omn_keylen);
+		if (cmp == 0)
+			return node;
 
-	err = orderedmap_clear(map);
-	if (err != 0)
-		return err;
+		dir = cmp > 0; /* left - false(0), right - true(1) */
+		p = node;
+		node = node->omn_child[dir];
+	}
 
-	assert(map->om_root == NULL);
-	assert(map->om_numnodes == 0);
-	return 0;
+	*parentp = p;
+	*dirp = dir;
+	return NULL;
 }
 
 
-int
-orderedmap_insert(orderedmap_t *map, const char *key, const void *val)
+void
+_orderedmap_link(struct orderedmap *map, struct orderedmapnode *parent,
+		 int dir, struct orderedmapnode *nnew)
 {
-	int cmp, dir;
-	size_t keysz;
-	size_t valsz;
 	struct orderedmapnode *node;
-	struct orderedmapnode *nnew;
 	struct orderedmapnode *uncle;
 	struct orderedmapnode *p, *gp;
-	char *kptr, *vptr;
-
-	if (!map || !key || !val)
-		return EINVAL;
-
-	keysz = strlen(key);
-	valsz = strlen(val);
-	if (map->om_root == NULL) {
-		nnew = malloc(sizeof(*nnew) + keysz + valsz);
-		if (nnew == NULL)
-			return ENOMEM;
-		memset(nnew, 0, sizeof(*nnew));
-
-		kptr = (char *)&nnew[1];
-		vptr = &kptr[keysz];
-		memcpy(kptr, key, keysz);
-		memcpy(vptr, val, valsz);
-		nnew->omn_key = kptr;
-		nnew->omn_val = vptr;
 
+	nnew->omn_parent = parent;
+	nnew->omn_child[0] = NULL;
+	nnew->omn_child[1] = NULL;
+	if (parent == NULL) {
 		map->om_root = nnew;
-		map->om_root->omn_color = OMN_BLACK;
+		map->om_last = nnew;
+		nnew->omn_color = OMN_BLACK;
 		map->om_numnodes++;
-		return 0;
-	}
-
-	node = map->om_root;
-	for (;;) {
-		cmp = strcmp(key, node->omn_key);
-		if (cmp == 0) {
-			/* match and we are it */
-			return EPERM;
-		}
-
-		dir = cmp > 0; /* left - false(0), right - true(1) */
-		if (node->omn_child[dir] != NULL) {
-			node = node->omn_child[dir];
-			continue;
-		}
-
-		/* insert the key value pair into the tree */
-		nnew = malloc(sizeof(*nnew) + keysz + valsz);
-		if (nnew == NULL)
-			return ENOMEM;
-		memset(nnew, 0, sizeof(*nnew));
-
-		kptr = (char *)&nnew[1];
-		vptr = &kptr[keysz];
-		memcpy(kptr, key, keysz);
-		memcpy(vptr, val, valsz);
-		nnew->omn_key = kptr;
-		nnew->omn_val = vptr;
-
-		node->omn_child[dir] = nnew;
-		nnew->omn_parent = node;
-		nnew->omn_color = OMN_RED;
-		break;
+		return;
 	}
+	parent->omn_child[dir] = nnew;
+	if (dir == 1 && parent == map->om_last)
+		map->om_last = nnew; /* rotations keep the order */
+	nnew->omn_color = OMN_RED;
 
 	/* rebalance the tree if required */
 	node = nnew;
@@ -356,21 +451,414 @@ orderedmap_insert(orderedmap_t *map, const char *key, const void *val)
 
 	map->om_root->omn_color = OMN_BLACK;
 	map->om_numnodes++;
+}
+
+
+int
+orderedmap_init(orderedmap_t *map)
+{
+	return orderedmap_init_cmp(map, NULL, NULL);
+}
+
+
+int
+orderedmap_init_cmp(orderedmap_t *map, orderedmap_cmp_t cmp, void *ctx)
+{
+	if (!map)
+		return EINVAL;
+
+	map->om_numnodes = 0;
+	map->om_root = NULL;
+	map->om_last = NULL;
+	map->om_cmp = cmp;
+	map->om_cmpctx = ctx;
+	map->om_pool = NULL;
+	map->om_blocks = NULL;
+	map->om_compactblock = NULL;
+	map->om_compactnext = NULL;
+	map->om_compactmoved = 0;
+	map->om_compacting = false;
+	map->om_owned = NULL;
+	map->om_trace = NULL;
+	return 0;
+}
+
+
+int
+orderedmap_bind_pool(orderedmap_t *map, struct internpool *pool)
+{
+	if (!map)
+		return EINVAL;
+	if (map->om_numnodes != 0)
+		return EBUSY;
+
+	map->om_pool = pool;
 	return 0;
 }
 
 
+int
+orderedmap_destroy(orderedmap_t *map)
+{
+	int err;
+	struct orderedmapowned *owned;
+
+	/* the teardown is not part of the workload */
+	if (map != NULL)
+		map->om_trace = NULL;
+	err = orderedmap_clear(map);
+	if (err != 0)
+		return err;
+
+	assert(map->om_root == NULL);
+	assert(map->om_numnodes == 0);
+
+	while ((owned = map->om_owned) != NULL) {
+		map->om_owned = owned->omo_next;
+		if (owned->omo_release != NULL)
+			owned->omo_release(owned->omo_buf, owned->omo_arg);
+		else
+			free(owned->omo_buf);
+		free(owned);
+	}
+	return 0;
+}
+
+
+int
+orderedmap_insert(orderedmap_t *map, const char *key, const void *val)
+{
+	if (!map || !key || !val)
+		return EINVAL;
+
+	return orderedmap_insertn(map, key, strlen(key), val, strlen(val));
+}
+
+
+int
+orderedmap_insertn(orderedmap_t *map, const char *key, size_t keylen,
+		   const void *val, size_t vallen)
+{
+	int dir;
+	struct orderedmapnode *parent;
+	struct orderedmapnode *nnew;
+
+	if (!map || !key || !val)
+		return EINVAL;
+	if (map->om_trace != NULL)
+		maptrace_record(map->om_trace, MAPTRACE_INSERT, key, keylen,
+				vallen);
+
+	if (_orderedmap_lookup_insert(map, key, keylen, &parent, &dir) != NULL) {
+		/* match and we are it */
+		return EPERM;
+	}
+
+	/* insert the key value pair into the tree */
+	nnew = _orderedmap_newnode(map, OMN_STRING, key, keylen, val, vallen);
+	if (nnew == NULL)
+		return ENOMEM;
+
+	_orderedmap_link(map, parent, dir, nnew);
+	return 0;
+}
+
+
+int
+orderedmap_insert_borrowed(orderedmap_t *map, const char *key, size_t keylen,
+			   const void *val, size_t vallen)
+{
+	int dir;
+	struct orderedmapnode *parent;
+	struct orderedmapnode *nnew;
+
+	if (!map || !key || !val)
+		return EINVAL;
+	if (map->om_trace != NULL)
+		maptrace_record(map->om_trace, MAPTRACE_INSERT, key, keylen,
+				vallen);
+
+	if (_orderedmap_lookup_insert(map, key, keylen, &parent, &dir) != NULL)
+		return EPERM;
+
+	/* just the node, the key and value stay where the caller has them */
+	nnew = malloc(sizeof(*nnew));
+	if (nnew == NULL)
+		return ENOMEM;
+	memset(nnew, 0, sizeof(*nnew));
+	nnew->omn_kind = OMN_STRING;
+	nnew->omn_borrowed = true;
+	nnew->omn_key = key;
+	if (map->om_pool != NULL) {
+		nnew->omn_key = internpool_intern(map->om_pool, key, keylen);
+		if (nnew->omn_key == NULL) {
+			free(nnew);
+			return ENOMEM;
+		}
+	}
+	nnew->omn_keylen = keylen;
+	nnew->omn_val = val;
+	nnew->omn_vallen = vallen;
+
+	_orderedmap_link(map, parent, dir, nnew);
+	return 0;
+}
+
+
+int
+orderedmap_adopt(orderedmap_t *map, void *buf, orderedmap_release_t release,
+		 void *arg)
+{
+	struct orderedmapowned *owned;
+
+	if (!map || !buf)
+		return EINVAL;
+
+	owned = malloc(sizeof(*owned));
+	if (owned == NULL)
+		return ENOMEM;
+	owned->omo_buf = buf;
+	owned->omo_release = release;
+	owned->omo_arg = arg;
+	owned->omo_next = map->om_owned;
+	map->om_owned = owned;
+	return 0;
+}
+
+
+int
+orderedmap_insert_hint(orderedmap_t *map, orderedmapnode_t **hint,
+		       const char *key, const void *val)
+{
+	if (!map || !hint || !key || !val)
+		return EINVAL;
+
+	return orderedmap_insertn_hint(map, hint, key, strlen(key),
+				       val, strlen(val));
+}
+
+
+int
+orderedmap_insertn_hint(orderedmap_t *map, orderedmapnode_t **hint,
+			const char *key, size_t keylen,
+			const void *val, size_t vallen)
+{
+	int cmp, dir;
+	struct orderedmapnode *node;
+	struct orderedmapnode *nbr;
+	struct orderedmapnode *parent;
+	struct orderedmapnode *nnew;
+
+	if (!map || !hint || !key || !val)
+		return EINVAL;
+	if (map->om_trace != NULL)
+		maptrace_record(map->om_trace, MAPTRACE_INSERT, key, keylen,
+				vallen);
+
+	/*
+	 * The key belongs right after the hint if it sorts between the
+	 * hint and its successor, or right before it when it sorts
+	 * between the predecessor and the hint. The new node then goes
+	 * into whichever of the two has the free child on that side.
+	 */
+	node = NULL;
+	parent = NULL;
+	dir = -1;
+	if ((nbr = *hint) != NULL) {
+		cmp = _orderedmap_cmp(map, key, keylen,
+				      nbr->omn_key, nbr->omn_keylen);
+		if (cmp == 0)
+			node = nbr;
+		else {
+			parent = nbr;
+			dir = cmp > 0;
+			nbr = dir ? orderedmap_next(parent) :
+				    orderedmap_prev(parent);
+		}
+		if (dir >= 0 && nbr != NULL) {
+			cmp = _orderedmap_cmp(map, key, keylen,
+					      nbr->omn_key, nbr->omn_keylen);
+			if (cmp == 0)
+				node = nbr;
+			else if ((cmp > 0) == dir)
+				dir = -1; /* further away than the neighbor */
+			else if (parent->omn_child[dir] != NULL) {
+				parent = nbr;
+				dir = !dir;
+			}
+		}
+	}
+	if (node == NULL && dir < 0)
+		node = _orderedmap_lookup_insert(map, key, keylen,
+						 &parent, &dir);
+
+	if (node != NULL) {
+		*hint = node;
+		return EPERM;
+	}
+
+	nnew = _orderedmap_newnode(map, OMN_STRING, key, keylen, val, vallen);
+	if (nnew == NULL)
+		return ENOMEM;
+
+	_orderedmap_link(map, parent, dir, nnew);
+	*hint = nnew;
+	return 0;
+}
+
+
+int
+_orderedmap_insertmap(struct orderedmap *map, const char *key,
+		      size_t keylen, struct orderedmap **childp)
+{
+	int dir;
+	struct orderedmapnode *node;
+	struct orderedmapnode *parent;
+	struct orderedmapnode *nnew;
+
+	/* traced here so tables made by update and patches are included */
+	if (map->om_trace != NULL)
+		maptrace_record(map->om_trace, MAPTRACE_INSERT, key, keylen, 0);
+
+	node = _orderedmap_lookup_insert(map, key, keylen, &parent, &dir);
+	if (node != NULL) {
+		/* an existing table is handed back to build on */
+		if (node->omn_kind == OMN_MAP)
+			*childp = orderedmap_getmap(node);
+		return EPERM;
+	}
+
+	nnew = _orderedmap_newnode(map, OMN_MAP, key, keylen, NULL, 0);
+	if (nnew == NULL)
+		return ENOMEM;
+
+	_orderedmap_link(map, parent, dir, nnew);
+	*childp = orderedmap_getmap(nnew);
+	return 0;
+}
+
+
+int
+orderedmap_insert_map(orderedmap_t *map, const char *key,
+		      orderedmap_t **child)
+{
+	if (!map || !key || !child)
+		return EINVAL;
+
+	return _orderedmap_insertmap(map, key, strlen(key), child);
+}
+
+
+orderedmap_t *
+orderedmap_getmap(const orderedmapnode_t *node)
+{
+	orderedmap_t *child;
+
+	if (!node || node->omn_kind != OMN_MAP)
+		return NULL;
+
+	memcpy(&child, &node[1], sizeof(child));
+	return child;
+}
+
+
+orderedmapnode_t *
+orderedmap_find_path(const orderedmap_t *map, const char *path)
+{
+	int dir;
+	size_t len;
+	struct orderedmapnode *node;
+	struct orderedmapnode *parent;
+
+	if (!map || !path)
+		return NULL;
+
+	/* each segment is looked up in place by its length */
+	for (;;) {
+		for (len = 0; path[len] != '\0' && path[len] != '.'; len++)
+			;
+		if (map->om_trace != NULL)
+			maptrace_record(map->om_trace, MAPTRACE_FIND, path, len,
+					0);
+		node = _orderedmap_lookup(map, path, len, &parent, &dir);
+		if (node == NULL || path[len] == '\0')
+			return node;
+
+		map = orderedmap_getmap(node);
+		if (map == NULL)
+			return NULL;
+		path = &path[len + 1];
+	}
+}
+
+
+orderedmapnode_t *
+orderedmap_find_path_v(const orderedmap_t *map, const char *const *segments,
+		       size_t nsegments)
+{
+	int dir;
+	size_t i, len;
+	struct orderedmapnode *node;
+	struct orderedmapnode *parent;
+
+	if (!map || !segments || nsegments == 0)
+		return NULL;
+
+	for (i = 0;; i++) {
+		if (segments[i] == NULL)
+			return NULL;
+		len = strlen(segments[i]);
+		if (map->om_trace != NULL)
+			maptrace_record(map->om_trace, MAPTRACE_FIND,
+					segments[i], len, 0);
+		node = _orderedmap_lookup(map, segments[i], len, &parent,
+					  &dir);
+		if (node == NULL || i + 1 == nsegments)
+			return node;
+
+		map = orderedmap_getmap(node);
+		if (map == NULL)
+			return NULL;
+	}
+}
+
+
 int
 orderedmap_erase(orderedmap_t *map, const char *key)
 {
+	int dir;
+	size_t keylen;
 	struct orderedmapnode *node;
+	struct orderedmapnode *parent;
+
+	if (!map || !key)
+		return ENOENT;
+
+	keylen = strlen(key);
+	if (map->om_trace != NULL)
+		maptrace_record(map->om_trace, MAPTRACE_ERASE, key, keylen, 0);
 
-	node = orderedmap_find(map, key);
+	node = _orderedmap_lookup(map, key, keylen, &parent, &dir);
 	if (node == NULL)
 		return ENOENT;
 
 	_orderedmap_remove(map, node);
-	free(node);
+	_orderedmap_freenode(map, node);
+	return 0;
+}
+
+
+int
+orderedmap_erase_node(orderedmap_t *map, orderedmapnode_t *node)
+{
+	if (!map || !node)
+		return EINVAL;
+	if (map->om_trace != NULL)
+		maptrace_record(map->om_trace, MAPTRACE_ERASE, node->omn_key,
+				node->omn_keylen, 0);
+
+	_orderedmap_remove(map, node);
+	_orderedmap_freenode(map, node);
 	return 0;
 }
 
@@ -380,6 +868,8 @@ orderedmap_update(orderedmap_t *map, const orderedmap_t *other)
 {
 	int err;
 	struct orderedmapnode *node;
+	struct orderedmapnode *old;
+	struct orderedmap *child;
 
 	if (!map || !other)
 		return EINVAL;
@@ -387,8 +877,34 @@ orderedmap_update(orderedmap_t *map, const orderedmap_t *other)
 	for (node = orderedmap_first(other);
 	     node != NULL;
 	     node = orderedmap_next(node)) {
-		orderedmap_erase(map, node->omn_key);
-		err = orderedmap_insert(map, node->omn_key, node->omn_val);
+		old = orderedmap_findn(map, node->omn_key, node->omn_keylen);
+		if (old != NULL && old->omn_kind == OMN_MAP &&
+		    node->omn_kind == OMN_MAP) {
+			/* a table under the key is refilled so it stays put */
+			child = orderedmap_getmap(old);
+			err = orderedmap_clear(child);
+			if (err == 0)
+				err = orderedmap_update(child,
+					orderedmap_getmap(node));
+			if (err != 0)
+				return err;
+			continue;
+		}
+		if (old != NULL)
+			orderedmap_erase_node(map, old);
+
+		if (node->omn_kind == OMN_MAP) {
+			/* tables are copied deep */
+			err = _orderedmap_insertmap(map, node->omn_key,
+						    node->omn_keylen, &child);
+			if (err == 0)
+				err = orderedmap_update(child,
+					orderedmap_getmap(node));
+		} else
+			err = orderedmap_insertn(map, node->omn_key,
+						 node->omn_keylen,
+						 node->omn_val,
+						 node->omn_vallen);
 		if (err != 0) {
 			return err;
 		}
@@ -404,14 +920,24 @@ orderedmap_clear(orderedmap_t *map)
 
 	if (!map)
 		return EINVAL;
+	if (map->om_trace != NULL)
+		maptrace_record(map->om_trace, MAPTRACE_CLEAR, NULL, 0, 0);
 
 	node = map->om_root;
 	while (node != NULL) {
 		_orderedmap_remove(map, node);
-		free(node);
+		_orderedmap_freenode(map, node);
 
 		node = map->om_root;
 	}
+
+	/* a pass that was under way has nothing left to move */
+	if (map->om_compactblock != NULL) {
+		_orderedmap_blockput(map, map->om_compactblock);
+		map->om_compactblock = NULL;
+	}
+	map->om_compacting = false;
+	assert(map->om_blocks == NULL);
 	return 0;
 }
 
@@ -419,25 +945,25 @@ orderedmap_clear(orderedmap_t *map)
 orderedmapnode_t *
 orderedmap_find(const orderedmap_t *map, const char *key)
 {
-	int cmp;
+	if (!map || !key)
+		return NULL;
+
+	return orderedmap_findn(map, key, strlen(key));
+}
+
+
+orderedmapnode_t *
+orderedmap_findn(const orderedmap_t *map, const char *key, size_t keylen)
+{
 	int dir;
-	struct orderedmapnode *node;
+	struct orderedmapnode *parent;
 
 	if (!map || !key)
 		return NULL;
+	if (map->om_trace != NULL)
+		maptrace_record(map->om_trace, MAPTRACE_FIND, key, keylen, 0);
 
-	node = map->om_root;
-	while (node != NULL) {
-		cmp = strcmp(key, node->omn_key);
-		if (cmp == 0) {
-			/* match and we are it */
-			return node;
-		}
-
-		dir = cmp > 0; /* left - false(0), right - true(1) */
-		node = node->omn_child[dir];
-	}
-	return NULL;
+	return _orderedmap_lookup(map, key, keylen, &parent, &dir);
 }
 
 
@@ -460,20 +986,12 @@ orderedmap_first(const orderedmap_t *map)
 
 
 orderedmapnode_t *
-map_last(const orderedmap_t *map)
+orderedmap_last(const orderedmap_t *map)
 {
-	struct orderedmapnode *node;
-
 	if (!map)
 		return NULL;
 
-	node = map->om_root;
-	while (node != NULL) {
-		if (node->omn_child[1] == NULL) /* right */
-			break;
-		node = node->omn_child[1];
-	}
-	return node;
+	return map->om_last;
 }
 
 
@@ -512,7 +1030,7 @@ orderedmap_next(const orderedmapnode_t *node)
 
 
 orderedmapnode_t *
-map_prev(const orderedmapnode_t *node)
+orderedmap_prev(const orderedmapnode_t *node)
 {
 	struct orderedmapnode *p;
 	struct orderedmapnode *ntmp;
@@ -520,10 +1038,10 @@ map_prev(const orderedmapnode_t *node)
 	if (!node)
 		return NULL;
 
-	if (node->omn_child[1] != NULL) {
-		ntmp = node->omn_child[1]; /* right child */
-		while (ntmp->omn_child[0] != NULL)
-			ntmp = ntmp->omn_child[0]; /* go left all the way */
+	if (node->omn_child[0] != NULL) {
+		ntmp = node->omn_child[0]; /* left child */
+		while (ntmp->omn_child[1] != NULL)
+			ntmp = ntmp->omn_child[1]; /* go right all the way */
 		return ntmp;
 	}
 
@@ -545,3 +1063,94 @@ map_prev(const orderedmapnode_t *node)
 	}
 	return p;
 }
+
+
+int
+orderedmap_cmp_bytes(const char *a, size_t alen,
+		     const char *b, size_t blen, void *ctx)
+{
+	int cmp;
+
+	(void)ctx;
+	cmp = memcmp(a, b, alen < blen ? alen : blen);
+	if (cmp != 0)
+		return cmp;
+	return (alen > blen) - (alen < blen);
+}
+
+
+int
+orderedmap_cmp_case(const char *a, size_t alen,
+		    const char *b, size_t blen, void *ctx)
+{
+	size_t i, len;
+	int ca, cb;
+
+	(void)ctx;
+	len = alen < blen ? alen : blen;
+	for (i = 0; i < len; i++) {
+		ca = tolower((unsigned char)a[i]);
+		cb = tolower((unsigned char)b[i]);
+		if (ca != cb)
+			return ca - cb;
+	}
+	return (alen > blen) - (alen < blen);
+}
+
+
+/* ASCII digits only, isdigit may accept more outside the C locale */
+static inline int
+_orderedmap_isdigit(char c)
+{
+	return c >= '0' && c <= '9';
+}
+
+
+/*
+ * Natural ordering compares runs of digits by their numeric value so
+ * "item9" sorts before "item10". Equal numbers with a different count
+ * of leading zeros are ordered by the zeros to keep keys distinct.
+ */
+int
+orderedmap_cmp_natural(const char *a, size_t alen,
+		       const char *b, size_t blen, void *ctx)
+{
+	size_t i, j;
+	size_t ai, bj, ae, be;
+	int cmp;
+
+	(void)ctx;
+	i = j = 0;
+	while (i < alen && j < blen) {
+		if (!_orderedmap_isdigit(a[i]) ||
+		    !_orderedmap_isdigit(b[j])) {
+			if (a[i] != b[j])
+				return (unsigned char)a[i] -
+				       (unsigned char)b[j];
+			i++;
+			j++;
+			continue;
+		}
+
+		for (ai = i; ai < alen && a[ai] == '0'; ai++)
+			;
+		for (bj = j; bj < blen && b[bj] == '0'; bj++)
+			;
+		for (ae = ai; ae < alen && _orderedmap_isdigit(a[ae]); ae++)
+			;
+		for (be = bj; be < blen && _orderedmap_isdigit(b[be]); be++)
+			;
+
+		/* more significant digits is a larger number */
+		if (ae - ai != be - bj)
+			return ae - ai < be - bj ? -1 : 1;
+		cmp = memcmp(&a[ai], &b[bj], ae - ai);
+		if (cmp != 0)
+			return cmp;
+		if (ai - i != bj - j)
+			return ai - i < bj - j ? -1 : 1;
+		i = ae;
+		j = be;
+	}
+	return (i < alen) - (j < blen);
+}
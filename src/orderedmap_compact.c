@@ -0,0 +1,259 @@
+/*
+ * Copyright (c) 2012-2023  Charles Hardin <ckhardin@gmail.com>
+ * All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/**
+ * @file orderedmap_compact.c
+ *
+ * Pack the nodes of a map into blocks in key order. After a long run
+ * of inserts and erases the nodes are spread over the heap and every
+ * step of a walk or descent is a cache miss; copying them one after
+ * the other into a block makes the neighbors in key order neighbors
+ * in memory too. The pass keeps a cursor in the map so it can be run
+ * a few nodes at a time.
+ */
+
+#include <sys/types.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <libcmap/orderedmap.h>
+
+#include "orderedmap_impl.h"
+
+#define _ORDEREDMAP_BLOCKHDR	_ORDEREDMAP_ALIGN(sizeof(struct orderedmapblock))
+
+
+void
+_orderedmap_blockput(struct orderedmap *map, struct orderedmapblock *block)
+{
+	if (--block->omb_refs != 0)
+		return;
+
+	if (block->omb_prev != NULL)
+		block->omb_prev->omb_next = block->omb_next;
+	else
+		map->om_blocks = block->omb_next;
+	if (block->omb_next != NULL)
+		block->omb_next->omb_prev = block->omb_prev;
+	free(block);
+}
+
+
+static struct orderedmapblock *
+_orderedmap_newblock(struct orderedmap *map, size_t size)
+{
+	struct orderedmapblock *block;
+
+	block = malloc(_ORDEREDMAP_BLOCKHDR + size);
+	if (block == NULL)
+		return NULL;
+
+	block->omb_refs = 1; /* held by the map while it is being filled */
+	block->omb_size = size;
+	block->omb_used = 0;
+	block->omb_prev = NULL;
+	block->omb_next = map->om_blocks;
+	if (block->omb_next != NULL)
+		block->omb_next->omb_prev = block;
+	map->om_blocks = block;
+	return block;
+}
+
+
+static void
+_orderedmap_endpass(struct orderedmap *map)
+{
+	if (map->om_compactblock != NULL) {
+		_orderedmap_blockput(map, map->om_compactblock);
+		map->om_compactblock = NULL;
+	}
+	map->om_compactnext = NULL;
+	map->om_compacting = false;
+}
+
+
+/*
+ * Copy a node into the next free space of the block and put the copy
+ * in its place in the tree. The key handle and the pointer to any
+ * nested table are taken over by the copy, so the old node is
+ * released without them and the table itself does not move.
+ */
+static void
+_orderedmap_relocate(struct orderedmap *map, struct orderedmapnode *node,
+		     struct orderedmapblock *block, size_t sz)
+{
+	struct orderedmapnode *nnew;
+	char *tail;
+
+	nnew = (struct orderedmapnode *)
+		((char *)block + _ORDEREDMAP_BLOCKHDR + block->omb_used);
+	block->omb_used += sz;
+	block->omb_refs++;
+
+	*nnew = *node;
+	nnew->omn_block = block;
+	nnew->omn_blocksize = sz;
+	tail = (char *)&nnew[1];
+	if (node->omn_borrowed) {
+		/* the bytes stay in the caller memory */
+	} else if (node->omn_kind == OMN_MAP) {
+		memcpy(tail, &node[1], sizeof(struct orderedmap *));
+		tail += sizeof(struct orderedmap *);
+	} else {
+		memcpy(tail, node->omn_val, node->omn_vallen);
+		tail[node->omn_vallen] = '\0';
+		nnew->omn_val = tail;
+		tail += node->omn_vallen + 1;
+	}
+	if (map->om_pool == NULL && !node->omn_borrowed) {
+		memcpy(tail, node->omn_key, node->omn_keylen);
+		tail[node->omn_keylen] = '\0';
+		nnew->omn_key = tail;
+	}
+
+	_orderedmap_swapnode(map, node, nnew);
+	if (node->omn_block != NULL)
+		_orderedmap_blockput(map, node->omn_block);
+	else
+		free(node);
+}
+
+
+int
+orderedmap_compact(orderedmap_t *map)
+{
+	if (!map)
+		return EINVAL;
+
+	/* start over so nodes added behind a partial pass are included */
+	_orderedmap_endpass(map);
+	return orderedmap_compact_step(map, SIZE_MAX);
+}
+
+
+int
+orderedmap_compact_step(orderedmap_t *map, size_t budget)
+{
+	size_t sz, size;
+	struct orderedmapnode *node;
+	struct orderedmapblock *block;
+
+	if (!map)
+		return EINVAL;
+
+	if (!map->om_compacting) {
+		map->om_compacting = true;
+		map->om_compactnext = orderedmap_first(map);
+		map->om_compactmoved = 0;
+	}
+
+	for (; budget > 0 && (node = map->om_compactnext) != NULL; budget--) {
+		sz = _ORDEREDMAP_ALIGN(_orderedmap_nodebytes(map, node));
+		if (sz > ORDEREDMAP_BLOCKSIZE) {
+			/* too large to gain anything from sharing a block */
+			map->om_compactnext = orderedmap_next(node);
+			continue;
+		}
+
+		block = map->om_compactblock;
+		if (block == NULL || block->omb_used + sz > block->omb_size) {
+			/*
+			 * Size the block for the nodes still to come, going
+			 * by this one, so a small map gets a small block.
+			 */
+			size = ORDEREDMAP_BLOCKSIZE;
+			if (map->om_numnodes - map->om_compactmoved > 0 &&
+			    (size_t)(map->om_numnodes - map->om_compactmoved) <
+			    size / sz)
+				size = (map->om_numnodes -
+					map->om_compactmoved) * sz;
+
+			block = _orderedmap_newblock(map, size);
+			if (block == NULL)
+				return ENOMEM;
+			if (map->om_compactblock != NULL)
+				_orderedmap_blockput(map, map->om_compactblock);
+			map->om_compactblock = block;
+		}
+
+		map->om_compactnext = orderedmap_next(node);
+		_orderedmap_relocate(map, node, block, sz);
+		map->om_compactmoved++;
+	}
+
+	if (map->om_compactnext != NULL)
+		return EAGAIN;
+	_orderedmap_endpass(map);
+	return 0;
+}
+
+
+static void
+_orderedmap_usage(const struct orderedmap *map, orderedmap_usage_t *usage)
+{
+	size_t sz, used;
+	const struct orderedmapnode *node;
+	const struct orderedmapblock *block;
+
+	used = 0;
+	for (block = map->om_blocks; block != NULL; block = block->omb_next) {
+		usage->omu_numblocks++;
+		usage->omu_blockbytes += _ORDEREDMAP_BLOCKHDR + block->omb_size;
+		used += block->omb_size;
+	}
+
+	for (node = orderedmap_first(map); node != NULL;
+	     node = orderedmap_next(node)) {
+		sz = _orderedmap_nodebytes(map, node);
+		usage->omu_numnodes++;
+		usage->omu_nodebytes += sz;
+		if (node->omn_block != NULL) {
+			/* a value shrunk in place keeps the space it was given */
+			usage->omu_blocknodes++;
+			usage->omu_slackbytes += node->omn_blocksize -
+						 _ORDEREDMAP_ALIGN(sz);
+			used -= node->omn_blocksize;
+		}
+		if (node->omn_kind == OMN_MAP) {
+			usage->omu_nodebytes += sizeof(struct orderedmap);
+			_orderedmap_usage(orderedmap_getmap(node), usage);
+		}
+	}
+	usage->omu_deadbytes += used;
+}
+
+
+int
+orderedmap_memory_usage(const orderedmap_t *map, orderedmap_usage_t *usage)
+{
+	if (!map || !usage)
+		return EINVAL;
+
+	memset(usage, 0, sizeof(*usage));
+	_orderedmap_usage(map, usage);
+	return 0;
+}
@@ -0,0 +1,413 @@
+/*
+ * Copyright (c) 2012-2023  Charles Hardin <ckhardin@gmail.com>
+ * All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/**
+ * @file orderedmap_diff.c
+ *
+ * Compare two ordered maps and carry the differences over to another
+ * map. Both trees are walked in key order side by side, like the
+ * merge step of a merge sort, so nothing is looked up twice.
+ */
+
+#include <sys/types.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <libcmap/orderedmap.h>
+
+#include "orderedmap_impl.h"
+
+struct orderedmap_patchseg {
+	size_t omps_keylen;
+	const char *omps_key;
+};
+
+struct orderedmap_patchentry {
+	orderedmap_diffop_t ompe_op;
+	size_t ompe_keylen;
+	size_t ompe_vallen;
+	const char *ompe_key;
+	const char *ompe_val;
+	struct orderedmap *ompe_map; /* copy of a table value or null */
+	size_t ompe_depth;
+	struct orderedmap_patchseg *ompe_path; /* enclosing table keys */
+};
+
+struct orderedmap_diffwalk {
+	orderedmap_diff_t odw_cb;
+	void *odw_ctx;
+	size_t odw_depth;
+	size_t odw_maxdepth;
+	const struct orderedmapnode **odw_path;
+};
+
+
+static int _orderedmap_diffmap(struct orderedmap_diffwalk *walk,
+	const struct orderedmap *oldmap, const struct orderedmap *newmap);
+
+
+static bool
+_orderedmap_sameval(const struct orderedmapnode *a,
+		    const struct orderedmapnode *b)
+{
+	const struct orderedmap *amap;
+	const struct orderedmap *bmap;
+
+	if (a->omn_kind != b->omn_kind)
+		return false;
+	if (a->omn_kind == OMN_STRING)
+		return a->omn_vallen == b->omn_vallen &&
+		       memcmp(a->omn_val, b->omn_val, a->omn_vallen) == 0;
+
+	/* tables are the same when every key and value is */
+	amap = orderedmap_getmap(a);
+	bmap = orderedmap_getmap(b);
+	if (amap->om_numnodes != bmap->om_numnodes)
+		return false;
+	for (a = orderedmap_first(amap), b = orderedmap_first(bmap);
+	     a != NULL;
+	     a = orderedmap_next(a), b = orderedmap_next(b)) {
+		if (_orderedmap_cmp(amap, a->omn_key, a->omn_keylen,
+				    b->omn_key, b->omn_keylen) != 0 ||
+		    !_orderedmap_sameval(a, b))
+			return false;
+	}
+	return true;
+}
+
+
+/*
+ * Descend into a pair of tables, the new table node is pushed on the
+ * path so the callback can tell which table a difference is in.
+ */
+static int
+_orderedmap_difftable(struct orderedmap_diffwalk *walk,
+		      const struct orderedmapnode *a,
+		      const struct orderedmapnode *b)
+{
+	int err;
+	size_t maxdepth;
+	const struct orderedmapnode **path;
+
+	if (walk->odw_depth == walk->odw_maxdepth) {
+		maxdepth = walk->odw_maxdepth ? walk->odw_maxdepth * 2 : 4;
+		path = realloc(walk->odw_path, maxdepth * sizeof(*path));
+		if (path == NULL)
+			return ENOMEM;
+		walk->odw_path = path;
+		walk->odw_maxdepth = maxdepth;
+	}
+	walk->odw_path[walk->odw_depth++] = b;
+	err = _orderedmap_diffmap(walk, orderedmap_getmap(a),
+				  orderedmap_getmap(b));
+	walk->odw_depth--;
+	return err;
+}
+
+
+static int
+_orderedmap_diffmap(struct orderedmap_diffwalk *walk,
+		    const struct orderedmap *oldmap,
+		    const struct orderedmap *newmap)
+{
+	int cmp, err;
+	struct orderedmapnode *a;
+	struct orderedmapnode *b;
+
+	a = orderedmap_first(oldmap);
+	b = orderedmap_first(newmap);
+	while (a != NULL || b != NULL) {
+		if (b == NULL)
+			cmp = -1;
+		else if (a == NULL)
+			cmp = 1;
+		else
+			cmp = _orderedmap_cmp(oldmap, a->omn_key, a->omn_keylen,
+					      b->omn_key, b->omn_keylen);
+
+		if (cmp < 0) {
+			err = walk->odw_cb(ORDEREDMAP_DIFF_REMOVED,
+					   walk->odw_path, walk->odw_depth,
+					   a, NULL, walk->odw_ctx);
+			a = orderedmap_next(a);
+		} else if (cmp > 0) {
+			err = walk->odw_cb(ORDEREDMAP_DIFF_ADDED,
+					   walk->odw_path, walk->odw_depth,
+					   NULL, b, walk->odw_ctx);
+			b = orderedmap_next(b);
+		} else {
+			/* two tables that order alike are compared by key */
+			err = 0;
+			if (a->omn_kind == OMN_MAP && b->omn_kind == OMN_MAP &&
+			    orderedmap_getmap(a)->om_cmp ==
+			    orderedmap_getmap(b)->om_cmp)
+				err = _orderedmap_difftable(walk, a, b);
+			else if (!_orderedmap_sameval(a, b))
+				err = walk->odw_cb(ORDEREDMAP_DIFF_CHANGED,
+						   walk->odw_path,
+						   walk->odw_depth,
+						   a, b, walk->odw_ctx);
+			a = orderedmap_next(a);
+			b = orderedmap_next(b);
+		}
+		if (err != 0)
+			return err;
+	}
+	return 0;
+}
+
+
+int
+orderedmap_diff(const orderedmap_t *oldmap, const orderedmap_t *newmap,
+		orderedmap_diff_t cb, void *ctx)
+{
+	int err;
+	struct orderedmap_diffwalk walk;
+
+	if (!oldmap || !newmap || !cb)
+		return EINVAL;
+
+	/* a lockstep walk only works when both agree on the order */
+	if (oldmap->om_cmp != newmap->om_cmp)
+		return EINVAL;
+
+	walk.odw_cb = cb;
+	walk.odw_ctx = ctx;
+	walk.odw_depth = 0;
+	walk.odw_maxdepth = 0;
+	walk.odw_path = NULL;
+	err = _orderedmap_diffmap(&walk, oldmap, newmap);
+	free(walk.odw_path);
+	return err;
+}
+
+
+int
+orderedmap_patch_init(orderedmap_patch_t *patch)
+{
+	if (!patch)
+		return EINVAL;
+
+	patch->omp_numentries = 0;
+	patch->omp_maxentries = 0;
+	patch->omp_entries = NULL;
+	return 0;
+}
+
+
+int
+orderedmap_patch_destroy(orderedmap_patch_t *patch)
+{
+	size_t i;
+
+	if (!patch)
+		return EINVAL;
+
+	for (i = 0; i < patch->omp_numentries; i++) {
+		if (patch->omp_entries[i]->ompe_map != NULL)
+			orderedmap_destroy(patch->omp_entries[i]->ompe_map);
+		free(patch->omp_entries[i]);
+	}
+	free(patch->omp_entries);
+	return orderedmap_patch_init(patch);
+}
+
+
+int
+orderedmap_patch_record(orderedmap_diffop_t op,
+			const orderedmapnode_t *const *path, size_t depth,
+			const orderedmapnode_t *oldnode,
+			const orderedmapnode_t *newnode, void *ctx)
+{
+	int err;
+	size_t i, maxentries;
+	size_t keylen, vallen, mapsz, pathsz;
+	const orderedmapnode_t *node;
+	const orderedmap_t *child;
+	orderedmap_patch_t *patch = ctx;
+	struct orderedmap_patchentry **entries;
+	struct orderedmap_patchentry *ent;
+	char *kptr, *vptr;
+
+	if (!patch)
+		return EINVAL;
+
+	node = newnode != NULL ? newnode : oldnode;
+	if (node == NULL)
+		return EINVAL;
+
+	if (patch->omp_numentries == patch->omp_maxentries) {
+		maxentries = patch->omp_maxentries ?
+			     patch->omp_maxentries * 2 : 16;
+		entries = realloc(patch->omp_entries,
+				  maxentries * sizeof(*entries));
+		if (entries == NULL)
+			return ENOMEM;
+		patch->omp_entries = entries;
+		patch->omp_maxentries = maxentries;
+	}
+
+	/*
+	 * a removal only needs the key, a table is copied after the entry
+	 * and the keys of the enclosing tables follow as path segments
+	 */
+	keylen = node->omn_keylen;
+	vallen = op == ORDEREDMAP_DIFF_REMOVED ? 0 : node->omn_vallen;
+	child = op == ORDEREDMAP_DIFF_REMOVED ? NULL : orderedmap_getmap(node);
+	mapsz = child != NULL ? sizeof(*child) : 0;
+	pathsz = depth * sizeof(*ent->ompe_path);
+	for (i = 0; i < depth; i++)
+		pathsz += path[i]->omn_keylen;
+	ent = malloc(sizeof(*ent) + mapsz + pathsz + keylen + 1 + vallen + 1);
+	if (ent == NULL)
+		return ENOMEM;
+
+	ent->ompe_map = NULL;
+	if (child != NULL) {
+		ent->ompe_map = (struct orderedmap *)&ent[1];
+		orderedmap_init_cmp(ent->ompe_map, child->om_cmp,
+				    child->om_cmpctx);
+		err = orderedmap_update(ent->ompe_map, child);
+		if (err != 0) {
+			orderedmap_destroy(ent->ompe_map);
+			free(ent);
+			return err;
+		}
+	}
+
+	ent->ompe_depth = depth;
+	ent->ompe_path = (struct orderedmap_patchseg *)((char *)&ent[1] +
+							 mapsz);
+	kptr = (char *)&ent->ompe_path[depth];
+	for (i = 0; i < depth; i++) {
+		memcpy(kptr, path[i]->omn_key, path[i]->omn_keylen);
+		ent->ompe_path[i].omps_keylen = path[i]->omn_keylen;
+		ent->ompe_path[i].omps_key = kptr;
+		kptr += path[i]->omn_keylen;
+	}
+	vptr = &kptr[keylen + 1];
+	memcpy(kptr, node->omn_key, keylen);
+	kptr[keylen] = '\0';
+	if (vallen != 0)
+		memcpy(vptr, node->omn_val, vallen);
+	vptr[vallen] = '\0';
+	ent->ompe_op = op;
+	ent->ompe_keylen = keylen;
+	ent->ompe_vallen = vallen;
+	ent->ompe_key = kptr;
+	ent->ompe_val = vptr;
+
+	patch->omp_entries[patch->omp_numentries++] = ent;
+	return 0;
+}
+
+
+/*
+ * Find the table an entry applies to by following its path from the
+ * top map. For anything but a removal the missing tables on the way
+ * are created, replacing a plain value that is in the way.
+ */
+static struct orderedmap *
+_orderedmap_patchtarget(struct orderedmap *map,
+			const struct orderedmap_patchentry *ent)
+{
+	size_t i;
+	struct orderedmapnode *node;
+	struct orderedmap *child;
+	const struct orderedmap_patchseg *seg;
+
+	for (i = 0; i < ent->ompe_depth; i++) {
+		seg = &ent->ompe_path[i];
+		node = orderedmap_findn(map, seg->omps_key, seg->omps_keylen);
+		child = orderedmap_getmap(node);
+		if (child == NULL) {
+			if (ent->ompe_op == ORDEREDMAP_DIFF_REMOVED)
+				return NULL;
+			if (node != NULL)
+				orderedmap_erase_node(map, node);
+			if (_orderedmap_insertmap(map, seg->omps_key,
+						  seg->omps_keylen,
+						  &child) != 0)
+				return NULL;
+		}
+		map = child;
+	}
+	return map;
+}
+
+
+int
+orderedmap_apply_patch(orderedmap_t *map, const orderedmap_patch_t *patch)
+{
+	int err;
+	size_t i;
+	struct orderedmapnode *node;
+	struct orderedmap *child;
+	struct orderedmap *target;
+	const struct orderedmap_patchentry *ent;
+
+	if (!map || !patch)
+		return EINVAL;
+
+	for (i = 0; i < patch->omp_numentries; i++) {
+		ent = patch->omp_entries[i];
+		target = _orderedmap_patchtarget(map, ent);
+		if (target == NULL) {
+			/* nothing to remove below a missing table */
+			if (ent->ompe_op == ORDEREDMAP_DIFF_REMOVED)
+				continue;
+			return ENOMEM;
+		}
+		node = orderedmap_findn(target, ent->ompe_key,
+					ent->ompe_keylen);
+
+		if (ent->ompe_op == ORDEREDMAP_DIFF_REMOVED) {
+			if (node != NULL)
+				orderedmap_erase_node(target, node);
+			continue;
+		}
+
+		if (ent->ompe_map != NULL) {
+			/* a table replaces the whole node */
+			if (node != NULL)
+				orderedmap_erase_node(target, node);
+			err = _orderedmap_insertmap(target, ent->ompe_key,
+						    ent->ompe_keylen, &child);
+			if (err == 0)
+				err = orderedmap_update(child, ent->ompe_map);
+		} else if (node != NULL)
+			err = _orderedmap_setval(target, &node, ent->ompe_val,
+						 ent->ompe_vallen);
+		else
+			err = orderedmap_insertn(target, ent->ompe_key,
+						 ent->ompe_keylen,
+						 ent->ompe_val,
+						 ent->ompe_vallen);
+		if (err != 0)
+			return err;
+	}
+	return 0;
+}
@@ -0,0 +1,160 @@
+/*
+ * Copyright (c) 2012-2023  Charles Hardin <ckhardin@gmail.com>
+ * All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/**
+ * @file orderedmap_impl.h
+ *
+ * Internal helpers shared between the ordered map source files. None
+ * of this is part of the installed api.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <string.h>
+
+#include <libcmap/orderedmap.h>
+
+static inline int
+_orderedmap_cmp(const struct orderedmap *map,
+		const char *a, size_t alen, const char *b, size_t blen)
+{
+	int cmp;
+
+	/* interned keys are equal exactly when the handles are */
+	if (a == b && alen == blen)
+		return 0;
+	if (map->om_cmp != NULL)
+		return map->om_cmp(a, alen, b, blen, map->om_cmpctx);
+
+	cmp = memcmp(a, b, alen < blen ? alen : blen);
+	if (cmp != 0)
+		return cmp;
+	return (alen > blen) - (alen < blen);
+}
+
+/*
+ * Memory that compacted nodes are packed into. The block counts the
+ * nodes in it, plus one while the map is still filling it, and is
+ * freed when that drops to zero.
+ */
+struct orderedmapblock {
+	struct orderedmapblock *omb_prev;
+	struct orderedmapblock *omb_next;
+	size_t omb_refs;
+	size_t omb_size;
+	size_t omb_used;
+};
+
+/* A buffer adopted by the map, released on destroy. */
+struct orderedmapowned {
+	struct orderedmapowned *omo_next;
+	void *omo_buf;
+	orderedmap_release_t omo_release;
+	void *omo_arg;
+};
+
+#define _ORDEREDMAP_ALIGN(x) \
+	(((x) + _Alignof(max_align_t) - 1) & ~(_Alignof(max_align_t) - 1))
+
+/*
+ * Bytes of a node with the tail holding the value or the pointer to a
+ * table, then the key. A table is allocated on its own so it stays in
+ * place when its node is moved.
+ */
+static inline size_t
+_orderedmap_nodesize(const struct orderedmap *map, int kind,
+		     size_t keylen, size_t vallen)
+{
+	size_t sz;
+
+	sz = sizeof(struct orderedmapnode);
+	sz += kind == OMN_MAP ? sizeof(struct orderedmap *) : vallen + 1;
+	if (map->om_pool == NULL)
+		sz += keylen + 1;
+	return sz;
+}
+
+/* Bytes used by a node that is in a map. */
+static inline size_t
+_orderedmap_nodebytes(const struct orderedmap *map,
+		      const struct orderedmapnode *node)
+{
+	if (node->omn_borrowed)
+		return sizeof(*node);
+	return _orderedmap_nodesize(map, node->omn_kind, node->omn_keylen,
+				    node->omn_vallen);
+}
+
+/* Drop a reference to a block, freeing it with the last one. */
+extern void _orderedmap_blockput(struct orderedmap *map,
+	struct orderedmapblock *block);
+
+/* Put a new node in the place of an old one, the old is not freed. */
+extern void _orderedmap_swapnode(struct orderedmap *map,
+	struct orderedmapnode *old, struct orderedmapnode *nnew);
+
+/* Replace the value of a node, the node may be reallocated. */
+extern int _orderedmap_setval(struct orderedmap *map,
+	struct orderedmapnode **nodep, const char *val, size_t vallen);
+
+/*
+ * Find the node for a key, or return null and set where a node with
+ * that key has to be linked.
+ */
+extern struct orderedmapnode *_orderedmap_lookup(const struct orderedmap *map,
+	const char *key, size_t keylen, struct orderedmapnode **parentp,
+	int *dirp);
+
+/*
+ * Same as #_orderedmap_lookup for an insert, a key past the end of
+ * the map is placed after the cached rightmost node right away.
+ */
+static inline struct orderedmapnode *
+_orderedmap_lookup_insert(const struct orderedmap *map, const char *key,
+			  size_t keylen, struct orderedmapnode **parentp,
+			  int *dirp)
+{
+	const struct orderedmapnode *last = map->om_last;
+
+	if (last != NULL &&
+	    _orderedmap_cmp(map, key, keylen, last->omn_key,
+			    last->omn_keylen) > 0) {
+		*parentp = (struct orderedmapnode *)last;
+		*dirp = 1;
+		return NULL;
+	}
+	return _orderedmap_lookup(map, key, keylen, parentp, dirp);
+}
+
+/* Link a node below the parent (null for the root) and rebalance. */
+extern void _orderedmap_link(struct orderedmap *map,
+	struct orderedmapnode *parent, int dir, struct orderedmapnode *nnew);
+
+/* Unlink a node from the tree and rebalance, the node is not freed. */
+extern void _orderedmap_remove(struct orderedmap *map,
+	struct orderedmapnode *node);
+
+/* Insert an empty nested table, see #orderedmap_insert_map. */
+extern int _orderedmap_insertmap(struct orderedmap *map, const char *key,
+	size_t keylen, struct orderedmap **childp);
@@ -0,0 +1,364 @@
+/*
+ * Copyright (c) 2012-2023  Charles Hardin <ckhardin@gmail.com>
+ * All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/**
+ * @file orderedmultimap.c
+ *
+ * Multimap on top of the ordered map red black tree. The tree nodes
+ * are extended with a run of values, so a duplicate key appends to
+ * the run of the existing node instead of adding a node.
+ */
+
+#include <sys/types.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+
+#include <libcmap/orderedmultimap.h>
+
+#include "orderedmap_impl.h"
+
+#define OMM_MINRUN	32
+
+
+/* the first run lives in the node tail right after the key */
+static inline char *
+_orderedmultimap_inlinerun(const struct orderedmultimapnode *node)
+{
+	return (char *)(uintptr_t)&node->ommn_node.omn_key[
+		node->ommn_node.omn_keylen + 1];
+}
+
+
+static void
+_orderedmultimap_freenode(struct orderedmultimapnode *node)
+{
+	if (node->ommn_run != _orderedmultimap_inlinerun(node))
+		free(node->ommn_run);
+	free(node);
+}
+
+
+static size_t
+_orderedmultimap_runcap(size_t cap, size_t need)
+{
+	if (cap == 0)
+		cap = OMM_MINRUN;
+	while (cap < need)
+		cap *= 2;
+	return cap;
+}
+
+
+static int
+_orderedmultimap_append(struct orderedmultimapnode *node,
+			const char *val, size_t vallen)
+{
+	size_t cap;
+	char *run;
+
+	if (node->ommn_runlen + vallen + 1 > node->ommn_runcap) {
+		/* spill out of the node the first time the run outgrows it */
+		cap = _orderedmultimap_runcap(node->ommn_runcap,
+					      node->ommn_runlen + vallen + 1);
+		if (node->ommn_run == _orderedmultimap_inlinerun(node)) {
+			run = malloc(cap);
+			if (run != NULL)
+				memcpy(run, node->ommn_run, node->ommn_runlen);
+		} else
+			run = realloc(node->ommn_run, cap);
+		if (run == NULL)
+			return ENOMEM;
+		node->ommn_run = run;
+		node->ommn_runcap = cap;
+	}
+
+	memcpy(&node->ommn_run[node->ommn_runlen], val, vallen);
+	node->ommn_run[node->ommn_runlen + vallen] = '\0';
+	node->ommn_runlen += vallen + 1;
+	node->ommn_count++;
+	return 0;
+}
+
+
+int
+orderedmultimap_init(orderedmultimap_t *mm)
+{
+	return orderedmultimap_init_cmp(mm, NULL, NULL);
+}
+
+
+int
+orderedmultimap_init_cmp(orderedmultimap_t *mm, orderedmap_cmp_t cmp,
+			 void *ctx)
+{
+	if (!mm)
+		return EINVAL;
+
+	mm->omm_numvals = 0;
+	return orderedmap_init_cmp(&mm->omm_map, cmp, ctx);
+}
+
+
+int
+orderedmultimap_destroy(orderedmultimap_t *mm)
+{
+	int err;
+
+	err = orderedmultimap_clear(mm);
+	if (err != 0)
+		return err;
+
+	assert(mm->omm_map.om_root == NULL);
+	assert(mm->omm_numvals == 0);
+	return 0;
+}
+
+
+int
+orderedmultimap_clear(orderedmultimap_t *mm)
+{
+	struct orderedmapnode *node;
+
+	if (!mm)
+		return EINVAL;
+
+	node = mm->omm_map.om_root;
+	while (node != NULL) {
+		_orderedmap_remove(&mm->omm_map, node);
+		_orderedmultimap_freenode((struct orderedmultimapnode *)node);
+
+		node = mm->omm_map.om_root;
+	}
+	mm->omm_numvals = 0;
+	return 0;
+}
+
+
+int
+orderedmultimap_insert(orderedmultimap_t *mm, const char *key,
+		       const void *val)
+{
+	if (!mm || !key || !val)
+		return EINVAL;
+
+	return orderedmultimap_insertn(mm, key, strlen(key), val, strlen(val));
+}
+
+
+int
+orderedmultimap_insertn(orderedmultimap_t *mm, const char *key,
+			size_t keylen, const void *val, size_t vallen)
+{
+	int err, dir;
+	size_t cap;
+	struct orderedmapnode *node;
+	struct orderedmapnode *parent;
+	struct orderedmultimapnode *nnew;
+	char *kptr;
+
+	if (!mm || !key || !val)
+		return EINVAL;
+	/* the run is split on the terminators */
+	if (memchr(val, '\0', vallen) != NULL)
+		return EINVAL;
+
+	node = _orderedmap_lookup_insert(&mm->omm_map, key, keylen, &parent,
+					 &dir);
+	if (node != NULL) {
+		/* duplicates go to the end of the run of the key */
+		err = _orderedmultimap_append(
+			(struct orderedmultimapnode *)node, val, vallen);
+		if (err == 0)
+			mm->omm_numvals++;
+		return err;
+	}
+
+	/* one allocation holds the node, the key and the first run */
+	cap = _orderedmultimap_runcap(0, vallen + 1);
+	nnew = malloc(sizeof(*nnew) + keylen + 1 + cap);
+	if (nnew == NULL)
+		return ENOMEM;
+	memset(nnew, 0, sizeof(*nnew));
+
+	kptr = (char *)&nnew[1];
+	memcpy(kptr, key, keylen);
+	kptr[keylen] = '\0';
+	nnew->ommn_node.omn_key = kptr;
+	nnew->ommn_node.omn_keylen = keylen;
+	nnew->ommn_run = _orderedmultimap_inlinerun(nnew);
+	nnew->ommn_runcap = cap;
+
+	/* cannot fail, the run was sized for the first value */
+	err = _orderedmultimap_append(nnew, val, vallen);
+	assert(err == 0);
+
+	_orderedmap_link(&mm->omm_map, parent, dir, &nnew->ommn_node);
+	mm->omm_numvals++;
+	return 0;
+}
+
+
+orderedmultimapnode_t *
+orderedmultimap_equal_range(const orderedmultimap_t *mm, const char *key)
+{
+	if (!mm)
+		return NULL;
+
+	return (orderedmultimapnode_t *)orderedmap_find(&mm->omm_map, key);
+}
+
+
+size_t
+orderedmultimap_find_all(const orderedmultimap_t *mm, const char *key,
+			 const char **vals, size_t maxvals)
+{
+	size_t i;
+	const char *val;
+	const struct orderedmultimapnode *node;
+
+	node = orderedmultimap_equal_range(mm, key);
+	if (node == NULL)
+		return 0;
+
+	for (i = 0, val = orderedmultimap_value_first(node);
+	     i < maxvals && val != NULL;
+	     i++, val = orderedmultimap_value_next(node, val))
+		vals[i] = val;
+	return node->ommn_count;
+}
+
+
+size_t
+orderedmultimap_count(const orderedmultimap_t *mm, const char *key)
+{
+	const struct orderedmultimapnode *node;
+
+	node = orderedmultimap_equal_range(mm, key);
+	return node ? node->ommn_count : 0;
+}
+
+
+int
+orderedmultimap_erase_one(orderedmultimap_t *mm, const char *key,
+			  const void *val)
+{
+	size_t vallen, len, off;
+	const char *v;
+	struct orderedmultimapnode *node;
+
+	if (!mm || !key || !val)
+		return EINVAL;
+
+	node = orderedmultimap_equal_range(mm, key);
+	if (node == NULL)
+		return ENOENT;
+
+	vallen = strlen(val);
+	for (v = orderedmultimap_value_first(node); v != NULL;
+	     v = orderedmultimap_value_next(node, v)) {
+		len = strlen(v);
+		if (len == vallen && memcmp(v, val, len) == 0)
+			break;
+	}
+	if (v == NULL)
+		return ENOENT;
+
+	if (node->ommn_count == 1)
+		return orderedmultimap_erase_all(mm, key);
+
+	/* close the gap so the run stays contiguous */
+	off = v - node->ommn_run;
+	memmove(&node->ommn_run[off], &node->ommn_run[off + len + 1],
+		node->ommn_runlen - off - len - 1);
+	node->ommn_runlen -= len + 1;
+	node->ommn_count--;
+	mm->omm_numvals--;
+	return 0;
+}
+
+
+int
+orderedmultimap_erase_all(orderedmultimap_t *mm, const char *key)
+{
+	struct orderedmultimapnode *node;
+
+	node = orderedmultimap_equal_range(mm, key);
+	if (node == NULL)
+		return ENOENT;
+
+	_orderedmap_remove(&mm->omm_map, &node->ommn_node);
+	mm->omm_numvals -= node->ommn_count;
+	_orderedmultimap_freenode(node);
+	return 0;
+}
+
+
+orderedmultimapnode_t *
+orderedmultimap_first(const orderedmultimap_t *mm)
+{
+	if (!mm)
+		return NULL;
+
+	return (orderedmultimapnode_t *)orderedmap_first(&mm->omm_map);
+}
+
+
+orderedmultimapnode_t *
+orderedmultimap_next(const orderedmultimapnode_t *node)
+{
+	if (!node)
+		return NULL;
+
+	return (orderedmultimapnode_t *)orderedmap_next(&node->ommn_node);
+}
+
+
+const char *
+orderedmultimap_value_first(const orderedmultimapnode_t *node)
+{
+	if (!node || node->ommn_count == 0)
+		return NULL;
+
+	return node->ommn_run;
+}
+
+
+const char *
+orderedmultimap_value_next(const orderedmultimapnode_t *node,
+			   const char *val)
+{
+	const char *next;
+
+	if (!node || !val)
+		return NULL;
+
+	next = val + strlen(val) + 1;
+	if (next >= &node->ommn_run[node->ommn_runlen])
+		return NULL;
+	return next;
+}
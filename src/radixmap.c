@@ -0,0 +1,1131 @@
+/*
+ * Copyright (c) 2012-2023  Charles Hardin <ckhardin@gmail.com>
+ * All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/**
+ * @file radixmap.c
+ *
+ * Adaptive radix tree as described in "The Adaptive Radix Tree:
+ * ARTful Indexing for Main-Memory Databases" (Leis et al.). Inner
+ * nodes grow and shrink between 4, 16, 48 and 256 children and keep
+ * up to RADIX_MAXPREFIX bytes of a compressed path; longer paths are
+ * checked optimistically against a leaf below the node.
+ *
+ * Every key is treated as if it had its terminating null byte, so no
+ * key is a prefix of another and the null sorts a key in front of the
+ * keys that extend it, matching strcmp ordering.
+ */
+
+#include <sys/types.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <libcmap/radixmap.h>
+
+#define RADIX_MAXPREFIX		10
+
+#define RADIX_ISLEAF(_p)	(((uintptr_t)(_p) & 1) != 0)
+#define RADIX_LEAF(_p)		((struct radixmapnode *)((uintptr_t)(_p) & ~1))
+#define RADIX_TAGLEAF(_l)	((void *)((uintptr_t)(_l) | 1))
+
+enum {
+	RADIX_NODE4 = 1,
+	RADIX_NODE16,
+	RADIX_NODE48,
+	RADIX_NODE256
+};
+
+struct radixinner {
+	uint8_t rn_type;
+	uint16_t rn_numchild;
+	uint32_t rn_prefixlen;
+	unsigned char rn_prefix[RADIX_MAXPREFIX];
+};
+
+struct radixnode4 {
+	struct radixinner n;
+	unsigned char keys[4];
+	void *child[4];
+};
+
+struct radixnode16 {
+	struct radixinner n;
+	unsigned char keys[16];
+	void *child[16];
+};
+
+struct radixnode48 {
+	struct radixinner n;
+	unsigned char index[256]; /* slot + 1, zero is empty */
+	void *child[48];
+};
+
+struct radixnode256 {
+	struct radixinner n;
+	void *child[256];
+};
+
+
+static inline unsigned char
+_radixmap_keybyte(const char *key, size_t keylen, size_t depth)
+{
+	/* the terminator is part of the key for the tree */
+	return depth < keylen ? (unsigned char)key[depth] : 0;
+}
+
+
+static inline size_t
+_radixmap_min(size_t a, size_t b)
+{
+	return a < b ? a : b;
+}
+
+
+static struct radixinner *
+_radixmap_alloc(int type)
+{
+	struct radixinner *n;
+	size_t sz;
+
+	switch (type) {
+	case RADIX_NODE4:
+		sz = sizeof(struct radixnode4);
+		break;
+	case RADIX_NODE16:
+		sz = sizeof(struct radixnode16);
+		break;
+	case RADIX_NODE48:
+		sz = sizeof(struct radixnode48);
+		break;
+	default:
+		sz = sizeof(struct radixnode256);
+		break;
+	}
+
+	n = calloc(1, sz);
+	if (n == NULL)
+		return NULL;
+	n->rn_type = type;
+	return n;
+}
+
+
+static void
+_radixmap_copyhdr(struct radixinner *dst, const struct radixinner *src)
+{
+	dst->rn_numchild = src->rn_numchild;
+	dst->rn_prefixlen = src->rn_prefixlen;
+	memcpy(dst->rn_prefix, src->rn_prefix,
+	       _radixmap_min(src->rn_prefixlen, RADIX_MAXPREFIX));
+}
+
+
+static void **
+_radixmap_findchild(struct radixinner *n, unsigned char c)
+{
+	int i;
+
+	switch (n->rn_type) {
+	case RADIX_NODE4: {
+		struct radixnode4 *p = (struct radixnode4 *)n;
+
+		for (i = 0; i < n->rn_numchild; i++) {
+			if (p->keys[i] == c)
+				return &p->child[i];
+		}
+		break;
+	}
+	case RADIX_NODE16: {
+		struct radixnode16 *p = (struct radixnode16 *)n;
+#ifdef __SSE2__
+		int bits;
+
+		/* compare all 16 keys at once */
+		bits = _mm_movemask_epi8(_mm_cmpeq_epi8(
+			_mm_set1_epi8((char)c),
+			_mm_loadu_si128((const __m128i *)p->keys)));
+		bits &= (1 << n->rn_numchild) - 1;
+		if (bits != 0)
+			return &p->child[__builtin_ctz(bits)];
+#else
+		for (i = 0; i < n->rn_numchild; i++) {
+			if (p->keys[i] == c)
+				return &p->child[i];
+		}
+#endif
+		break;
+	}
+	case RADIX_NODE48: {
+		struct radixnode48 *p = (struct radixnode48 *)n;
+
+		if (p->index[c] != 0)
+			return &p->child[p->index[c] - 1];
+		break;
+	}
+	case RADIX_NODE256: {
+		struct radixnode256 *p = (struct radixnode256 *)n;
+
+		if (p->child[c] != NULL)
+			return &p->child[c];
+		break;
+	}
+	}
+	return NULL;
+}
+
+
+/*
+ * Return the child with the largest key byte below c (dir 0) or the
+ * smallest key byte above c (dir 1), the neighbours of a new child.
+ */
+static void *
+_radixmap_sibling(struct radixinner *n, int c, int dir)
+{
+	int i;
+
+	switch (n->rn_type) {
+	case RADIX_NODE4:
+	case RADIX_NODE16: {
+		unsigned char *keys;
+		void **child;
+
+		if (n->rn_type == RADIX_NODE4) {
+			keys = ((struct radixnode4 *)n)->keys;
+			child = ((struct radixnode4 *)n)->child;
+		} else {
+			keys = ((struct radixnode16 *)n)->keys;
+			child = ((struct radixnode16 *)n)->child;
+		}
+		if (dir == 0) {
+			for (i = n->rn_numchild - 1; i >= 0; i--) {
+				if (keys[i] < c)
+					return child[i];
+			}
+		} else {
+			for (i = 0; i < n->rn_numchild; i++) {
+				if (keys[i] > c)
+					return child[i];
+			}
+		}
+		break;
+	}
+	case RADIX_NODE48: {
+		struct radixnode48 *p = (struct radixnode48 *)n;
+
+		for (i = dir ? c + 1 : c - 1; i >= 0 && i < 256;
+		     i += dir ? 1 : -1) {
+			if (p->index[i] != 0)
+				return p->child[p->index[i] - 1];
+		}
+		break;
+	}
+	case RADIX_NODE256: {
+		struct radixnode256 *p = (struct radixnode256 *)n;
+
+		for (i = dir ? c + 1 : c - 1; i >= 0 && i < 256;
+		     i += dir ? 1 : -1) {
+			if (p->child[i] != NULL)
+				return p->child[i];
+		}
+		break;
+	}
+	}
+	return NULL;
+}
+
+
+/* follow the smallest (dir 0) or largest (dir 1) child to a leaf */
+static struct radixmapnode *
+_radixmap_edgeleaf(void *p, int dir)
+{
+	struct radixinner *n;
+
+	while (p != NULL && !RADIX_ISLEAF(p)) {
+		n = p;
+		p = _radixmap_sibling(n, dir ? 256 : -1, !dir);
+	}
+	return p ? RADIX_LEAF(p) : NULL;
+}
+
+
+static bool
+_radixmap_leafmatch(const struct radixmapnode *leaf,
+		    const char *key, size_t keylen)
+{
+	return leaf->rmn_keylen == keylen &&
+	       memcmp(leaf->rmn_key, key, keylen) == 0;
+}
+
+
+/*
+ * Return the number of bytes of the compressed path that match the
+ * key, using a leaf for the part that is not stored in the node.
+ */
+static size_t
+_radixmap_mismatch(struct radixinner *n, const char *key, size_t keylen,
+		   size_t depth)
+{
+	size_t i, max;
+	const struct radixmapnode *leaf;
+
+	max = _radixmap_min(n->rn_prefixlen, RADIX_MAXPREFIX);
+	for (i = 0; i < max; i++) {
+		if (n->rn_prefix[i] !=
+		    _radixmap_keybyte(key, keylen, depth + i))
+			return i;
+	}
+
+	if (n->rn_prefixlen > RADIX_MAXPREFIX) {
+		leaf = _radixmap_edgeleaf(n, 0);
+		for (; i < n->rn_prefixlen; i++) {
+			if (_radixmap_keybyte(leaf->rmn_key, leaf->rmn_keylen,
+					      depth + i) !=
+			    _radixmap_keybyte(key, keylen, depth + i))
+				return i;
+		}
+	}
+	return i;
+}
+
+
+static void
+_radixmap_link(struct radixmap *map, struct radixmapnode *node,
+	       struct radixmapnode *pos, int dir)
+{
+	struct radixmapnode *other;
+
+	/* dir 0 puts node before pos and dir 1 after pos */
+	other = pos->rmn_link[dir];
+	node->rmn_link[!dir] = pos;
+	node->rmn_link[dir] = other;
+	pos->rmn_link[dir] = node;
+	if (other != NULL)
+		other->rmn_link[!dir] = node;
+	else if (dir == 0)
+		map->rm_head = node;
+	else
+		map->rm_tail = node;
+}
+
+
+static void
+_radixmap_unlink(struct radixmap *map, struct radixmapnode *node)
+{
+	if (node->rmn_link[0] != NULL)
+		node->rmn_link[0]->rmn_link[1] = node->rmn_link[1];
+	else
+		map->rm_head = node->rmn_link[1];
+	if (node->rmn_link[1] != NULL)
+		node->rmn_link[1]->rmn_link[0] = node->rmn_link[0];
+	else
+		map->rm_tail = node->rmn_link[0];
+}
+
+
+static int
+_radixmap_addchild(void **ref, struct radixinner *n, unsigned char c,
+		   void *child)
+{
+	int i;
+	struct radixinner *nnew;
+
+	switch (n->rn_type) {
+	case RADIX_NODE4: {
+		struct radixnode4 *p = (struct radixnode4 *)n;
+		struct radixnode16 *g;
+
+		if (n->rn_numchild < 4) {
+			for (i = 0; i < n->rn_numchild; i++) {
+				if (c < p->keys[i])
+					break;
+			}
+			memmove(&p->keys[i + 1], &p->keys[i],
+				n->rn_numchild - i);
+			memmove(&p->child[i + 1], &p->child[i],
+				(n->rn_numchild - i) * sizeof(void *));
+			p->keys[i] = c;
+			p->child[i] = child;
+			n->rn_numchild++;
+			return 0;
+		}
+
+		nnew = _radixmap_alloc(RADIX_NODE16);
+		if (nnew == NULL)
+			return ENOMEM;
+		g = (struct radixnode16 *)nnew;
+		_radixmap_copyhdr(nnew, n);
+		memcpy(g->keys, p->keys, sizeof(p->keys));
+		memcpy(g->child, p->child, sizeof(p->child));
+		break;
+	}
+	case RADIX_NODE16: {
+		struct radixnode16 *p = (struct radixnode16 *)n;
+		struct radixnode48 *g;
+
+		if (n->rn_numchild < 16) {
+#ifdef __SSE2__
+			int bits;
+
+			/* count the keys above c with a biased compare */
+			bits = _mm_movemask_epi8(_mm_cmplt_epi8(
+				_mm_set1_epi8((char)(c ^ 0x80)),
+				_mm_xor_si128(
+					_mm_loadu_si128(
+						(const __m128i *)p->keys),
+					_mm_set1_epi8((char)0x80))));
+			bits &= (1 << n->rn_numchild) - 1;
+			i = bits ? __builtin_ctz(bits) : n->rn_numchild;
+#else
+			for (i = 0; i < n->rn_numchild; i++) {
+				if (c < p->keys[i])
+					break;
+			}
+#endif
+			memmove(&p->keys[i + 1], &p->keys[i],
+				n->rn_numchild - i);
+			memmove(&p->child[i + 1], &p->child[i],
+				(n->rn_numchild - i) * sizeof(void *));
+			p->keys[i] = c;
+			p->child[i] = child;
+			n->rn_numchild++;
+			return 0;
+		}
+
+		nnew = _radixmap_alloc(RADIX_NODE48);
+		if (nnew == NULL)
+			return ENOMEM;
+		g = (struct radixnode48 *)nnew;
+		_radixmap_copyhdr(nnew, n);
+		for (i = 0; i < 16; i++) {
+			g->index[p->keys[i]] = i + 1;
+			g->child[i] = p->child[i];
+		}
+		break;
+	}
+	case RADIX_NODE48: {
+		struct radixnode48 *p = (struct radixnode48 *)n;
+		struct radixnode256 *g;
+
+		if (n->rn_numchild < 48) {
+			for (i = 0; p->child[i] != NULL; i++)
+				;
+			p->child[i] = child;
+			p->index[c] = i + 1;
+			n->rn_numchild++;
+			return 0;
+		}
+
+		nnew = _radixmap_alloc(RADIX_NODE256);
+		if (nnew == NULL)
+			return ENOMEM;
+		g = (struct radixnode256 *)nnew;
+		_radixmap_copyhdr(nnew, n);
+		for (i = 0; i < 256; i++) {
+			if (p->index[i] != 0)
+				g->child[i] = p->child[p->index[i] - 1];
+		}
+		break;
+	}
+	default: {
+		struct radixnode256 *p = (struct radixnode256 *)n;
+
+		p->child[c] = child;
+		n->rn_numchild++;
+		return 0;
+	}
+	}
+
+	/* the node was full and has been copied into a larger one */
+	*ref = nnew;
+	free(n);
+	return _radixmap_addchild(ref, nnew, c, child);
+}
+
+
+static void
+_radixmap_removechild(void **ref, struct radixinner *n, unsigned char c,
+		      void **slot)
+{
+	int i, j;
+	struct radixinner *nnew;
+
+	switch (n->rn_type) {
+	case RADIX_NODE4:
+	case RADIX_NODE16: {
+		unsigned char *keys;
+		void **child;
+
+		if (n->rn_type == RADIX_NODE4) {
+			keys = ((struct radixnode4 *)n)->keys;
+			child = ((struct radixnode4 *)n)->child;
+		} else {
+			keys = ((struct radixnode16 *)n)->keys;
+			child = ((struct radixnode16 *)n)->child;
+		}
+		i = slot - child;
+		memmove(&keys[i], &keys[i + 1], n->rn_numchild - i - 1);
+		memmove(&child[i], &child[i + 1],
+			(n->rn_numchild - i - 1) * sizeof(void *));
+		n->rn_numchild--;
+		break;
+	}
+	case RADIX_NODE48: {
+		struct radixnode48 *p = (struct radixnode48 *)n;
+
+		p->child[p->index[c] - 1] = NULL;
+		p->index[c] = 0;
+		n->rn_numchild--;
+		break;
+	}
+	case RADIX_NODE256: {
+		struct radixnode256 *p = (struct radixnode256 *)n;
+
+		p->child[c] = NULL;
+		n->rn_numchild--;
+		break;
+	}
+	}
+
+	/*
+	 * Shrink with some hysteresis so an insert and erase at the
+	 * boundary does not resize every time. A failed allocation
+	 * just leaves the larger node in place.
+	 */
+	switch (n->rn_type) {
+	case RADIX_NODE4: {
+		struct radixnode4 *p = (struct radixnode4 *)n;
+		struct radixinner *child;
+		size_t len;
+
+		if (n->rn_numchild != 1)
+			return;
+
+		/* a single child is merged with this node */
+		if (!RADIX_ISLEAF(p->child[0])) {
+			child = p->child[0];
+			len = n->rn_prefixlen;
+			if (len < RADIX_MAXPREFIX)
+				n->rn_prefix[len++] = p->keys[0];
+			if (len < RADIX_MAXPREFIX) {
+				j = _radixmap_min(child->rn_prefixlen,
+						  RADIX_MAXPREFIX - len);
+				memcpy(&n->rn_prefix[len], child->rn_prefix,
+				       j);
+				len += j;
+			}
+			memcpy(child->rn_prefix, n->rn_prefix,
+			       _radixmap_min(len, RADIX_MAXPREFIX));
+			child->rn_prefixlen += n->rn_prefixlen + 1;
+		}
+		*ref = p->child[0];
+		free(n);
+		return;
+	}
+	case RADIX_NODE16: {
+		struct radixnode16 *p = (struct radixnode16 *)n;
+		struct radixnode4 *s;
+
+		if (n->rn_numchild != 3)
+			return;
+		nnew = _radixmap_alloc(RADIX_NODE4);
+		if (nnew == NULL)
+			return;
+		s = (struct radixnode4 *)nnew;
+		_radixmap_copyhdr(nnew, n);
+		memcpy(s->keys, p->keys, 3);
+		memcpy(s->child, p->child, 3 * sizeof(void *));
+		break;
+	}
+	case RADIX_NODE48: {
+		struct radixnode48 *p = (struct radixnode48 *)n;
+		struct radixnode16 *s;
+
+		if (n->rn_numchild != 12)
+			return;
+		nnew = _radixmap_alloc(RADIX_NODE16);
+		if (nnew == NULL)
+			return;
+		s = (struct radixnode16 *)nnew;
+		_radixmap_copyhdr(nnew, n);
+		for (i = 0, j = 0; i < 256; i++) {
+			if (p->index[i] != 0) {
+				s->keys[j] = i;
+				s->child[j++] = p->child[p->index[i] - 1];
+			}
+		}
+		break;
+	}
+	default: {
+		struct radixnode256 *p = (struct radixnode256 *)n;
+		struct radixnode48 *s;
+
+		if (n->rn_numchild != 37)
+			return;
+		nnew = _radixmap_alloc(RADIX_NODE48);
+		if (nnew == NULL)
+			return;
+		s = (struct radixnode48 *)nnew;
+		_radixmap_copyhdr(nnew, n);
+		for (i = 0, j = 0; i < 256; i++) {
+			if (p->child[i] != NULL) {
+				s->child[j] = p->child[i];
+				s->index[i] = ++j;
+			}
+		}
+		break;
+	}
+	}
+
+	*ref = nnew;
+	free(n);
+}
+
+
+static int
+_radixmap_insert(struct radixmap *map, void **ref, const char *key,
+		 size_t keylen, size_t depth, struct radixmapnode *leaf)
+{
+	int err;
+	size_t i, mismatch;
+	unsigned char c, oc;
+	void *p, *sib;
+	void **slot;
+	struct radixinner *n, *nnew;
+	struct radixmapnode *other;
+
+	p = *ref;
+	if (RADIX_ISLEAF(p)) {
+		other = RADIX_LEAF(p);
+		if (_radixmap_leafmatch(other, key, keylen))
+			return EPERM;
+
+		/* split the leaf into a node with the common prefix */
+		nnew = _radixmap_alloc(RADIX_NODE4);
+		if (nnew == NULL)
+			return ENOMEM;
+		for (i = depth;; i++) {
+			c = _radixmap_keybyte(key, keylen, i);
+			oc = _radixmap_keybyte(other->rmn_key,
+					       other->rmn_keylen, i);
+			if (c != oc)
+				break;
+		}
+		nnew->rn_prefixlen = i - depth;
+		memcpy(nnew->rn_prefix, &key[depth],
+		       _radixmap_min(i - depth, RADIX_MAXPREFIX));
+		_radixmap_addchild(ref, nnew, oc, p);
+		_radixmap_addchild(ref, nnew, c, RADIX_TAGLEAF(leaf));
+		_radixmap_link(map, leaf, other, c > oc);
+		*ref = nnew;
+		return 0;
+	}
+
+	n = p;
+	if (n->rn_prefixlen != 0) {
+		mismatch = _radixmap_mismatch(n, key, keylen, depth);
+		if (mismatch < n->rn_prefixlen) {
+			/* the key leaves the compressed path part way */
+			nnew = _radixmap_alloc(RADIX_NODE4);
+			if (nnew == NULL)
+				return ENOMEM;
+			nnew->rn_prefixlen = mismatch;
+			memcpy(nnew->rn_prefix, n->rn_prefix,
+			       _radixmap_min(mismatch, RADIX_MAXPREFIX));
+
+			if (n->rn_prefixlen <= RADIX_MAXPREFIX) {
+				oc = n->rn_prefix[mismatch];
+				n->rn_prefixlen -= mismatch + 1;
+				memmove(n->rn_prefix,
+					&n->rn_prefix[mismatch + 1],
+					n->rn_prefixlen);
+			} else {
+				other = _radixmap_edgeleaf(n, 0);
+				oc = _radixmap_keybyte(other->rmn_key,
+						       other->rmn_keylen,
+						       depth + mismatch);
+				n->rn_prefixlen -= mismatch + 1;
+				memcpy(n->rn_prefix,
+				       &other->rmn_key[depth + mismatch + 1],
+				       _radixmap_min(n->rn_prefixlen,
+						     RADIX_MAXPREFIX));
+			}
+
+			c = _radixmap_keybyte(key, keylen, depth + mismatch);
+			_radixmap_addchild(ref, nnew, oc, n);
+			_radixmap_addchild(ref, nnew, c, RADIX_TAGLEAF(leaf));
+			if (c < oc)
+				_radixmap_link(map, leaf,
+					       _radixmap_edgeleaf(n, 0), 0);
+			else
+				_radixmap_link(map, leaf,
+					       _radixmap_edgeleaf(n, 1), 1);
+			*ref = nnew;
+			return 0;
+		}
+		depth += n->rn_prefixlen;
+	}
+
+	c = _radixmap_keybyte(key, keylen, depth);
+	slot = _radixmap_findchild(n, c);
+	if (slot != NULL)
+		return _radixmap_insert(map, slot, key, keylen, depth + 1,
+					leaf);
+
+	/* the neighbours in key order are under the sibling children */
+	sib = _radixmap_sibling(n, c, 0);
+	err = _radixmap_addchild(ref, n, c, RADIX_TAGLEAF(leaf));
+	if (err != 0)
+		return err;
+	if (sib != NULL)
+		_radixmap_link(map, leaf, _radixmap_edgeleaf(sib, 1), 1);
+	else
+		_radixmap_link(map, leaf,
+			       _radixmap_edgeleaf(_radixmap_sibling(*ref, c, 1),
+						  0), 0);
+	return 0;
+}
+
+
+static struct radixmapnode *
+_radixmap_erase(void **ref, const char *key, size_t keylen, size_t depth)
+{
+	unsigned char c;
+	void **slot;
+	struct radixinner *n;
+	struct radixmapnode *leaf;
+
+	for (;;) {
+		n = *ref;
+		if (n == NULL)
+			return NULL;
+
+		if (RADIX_ISLEAF(n)) {
+			/* only a leaf as the root gets here */
+			leaf = RADIX_LEAF(n);
+			if (!_radixmap_leafmatch(leaf, key, keylen))
+				return NULL;
+			*ref = NULL;
+			return leaf;
+		}
+
+		if (n->rn_prefixlen != 0) {
+			if (_radixmap_mismatch(n, key, keylen, depth) !=
+			    n->rn_prefixlen)
+				return NULL;
+			depth += n->rn_prefixlen;
+		}
+		if (depth > keylen)
+			return NULL;
+
+		c = _radixmap_keybyte(key, keylen, depth);
+		slot = _radixmap_findchild(n, c);
+		if (slot == NULL)
+			return NULL;
+
+		if (RADIX_ISLEAF(*slot)) {
+			leaf = RADIX_LEAF(*slot);
+			if (!_radixmap_leafmatch(leaf, key, keylen))
+				return NULL;
+			_radixmap_removechild(ref, n, c, slot);
+			return leaf;
+		}
+
+		ref = slot;
+		depth++;
+	}
+}
+
+
+static void
+_radixmap_freeinner(void *p)
+{
+	int i;
+	struct radixinner *n;
+
+	if (p == NULL || RADIX_ISLEAF(p))
+		return;
+
+	n = p;
+	switch (n->rn_type) {
+	case RADIX_NODE4:
+		for (i = 0; i < n->rn_numchild; i++)
+			_radixmap_freeinner(((struct radixnode4 *)n)->child[i]);
+		break;
+	case RADIX_NODE16:
+		for (i = 0; i < n->rn_numchild; i++)
+			_radixmap_freeinner(
+				((struct radixnode16 *)n)->child[i]);
+		break;
+	case RADIX_NODE48:
+		for (i = 0; i < 48; i++)
+			_radixmap_freeinner(
+				((struct radixnode48 *)n)->child[i]);
+		break;
+	case RADIX_NODE256:
+		for (i = 0; i < 256; i++)
+			_radixmap_freeinner(
+				((struct radixnode256 *)n)->child[i]);
+		break;
+	}
+	free(n);
+}
+
+
+int
+radixmap_init(radixmap_t *map)
+{
+	if (!map)
+		return EINVAL;
+
+	map->rm_numnodes = 0;
+	map->rm_root = NULL;
+	map->rm_head = NULL;
+	map->rm_tail = NULL;
+	return 0;
+}
+
+
+int
+radixmap_destroy(radixmap_t *map)
+{
+	int err;
+
+	err = radixmap_clear(map);
+	if (err != 0)
+		return err;
+
+	assert(map->rm_root == NULL);
+	assert(map->rm_numnodes == 0);
+	return 0;
+}
+
+
+int
+radixmap_insert(radixmap_t *map, const char *key, const void *val)
+{
+	if (!map || !key || !val)
+		return EINVAL;
+
+	return radixmap_insertn(map, key, strlen(key), val, strlen(val));
+}
+
+
+int
+radixmap_insertn(radixmap_t *map, const char *key, size_t keylen,
+		 const void *val, size_t vallen)
+{
+	int err;
+	struct radixmapnode *nnew;
+	char *kptr, *vptr;
+
+	if (!map || !key || !val)
+		return EINVAL;
+	if (memchr(key, '\0', keylen) != NULL)
+		return EINVAL;
+
+	nnew = malloc(sizeof(*nnew) + keylen + 1 + vallen + 1);
+	if (nnew == NULL)
+		return ENOMEM;
+	memset(nnew, 0, sizeof(*nnew));
+
+	kptr = (char *)&nnew[1];
+	vptr = &kptr[keylen + 1];
+	memcpy(kptr, key, keylen);
+	kptr[keylen] = '\0';
+	memcpy(vptr, val, vallen);
+	vptr[vallen] = '\0';
+	nnew->rmn_keylen = keylen;
+	nnew->rmn_vallen = vallen;
+	nnew->rmn_key = kptr;
+	nnew->rmn_val = vptr;
+
+	if (map->rm_root == NULL) {
+		map->rm_root = RADIX_TAGLEAF(nnew);
+		map->rm_head = nnew;
+		map->rm_tail = nnew;
+		map->rm_numnodes++;
+		return 0;
+	}
+
+	err = _radixmap_insert(map, &map->rm_root, key, keylen, 0, nnew);
+	if (err != 0) {
+		free(nnew);
+		return err;
+	}
+	map->rm_numnodes++;
+	return 0;
+}
+
+
+int
+radixmap_erase(radixmap_t *map, const char *key)
+{
+	if (!map || !key)
+		return EINVAL;
+
+	return radixmap_erasen(map, key, strlen(key));
+}
+
+
+int
+radixmap_erasen(radixmap_t *map, const char *key, size_t keylen)
+{
+	struct radixmapnode *leaf;
+
+	if (!map || !key)
+		return EINVAL;
+
+	leaf = _radixmap_erase(&map->rm_root, key, keylen, 0);
+	if (leaf == NULL)
+		return ENOENT;
+
+	_radixmap_unlink(map, leaf);
+	map->rm_numnodes--;
+	free(leaf);
+	return 0;
+}
+
+
+int
+radixmap_update(radixmap_t *map, const radixmap_t *other)
+{
+	int err;
+	struct radixmapnode *node;
+
+	if (!map || !other)
+		return EINVAL;
+
+	for (node = other->rm_head; node != NULL; node = node->rmn_link[1]) {
+		radixmap_erase(map, node->rmn_key);
+		err = radixmap_insertn(map, node->rmn_key, node->rmn_keylen,
+				       node->rmn_val, node->rmn_vallen);
+		if (err != 0)
+			return err;
+	}
+	return 0;
+}
+
+
+int
+radixmap_clear(radixmap_t *map)
+{
+	struct radixmapnode *node;
+	struct radixmapnode *next;
+
+	if (!map)
+		return EINVAL;
+
+	_radixmap_freeinner(map->rm_root);
+	for (node = map->rm_head; node != NULL; node = next) {
+		next = node->rmn_link[1];
+		free(node);
+	}
+	map->rm_numnodes = 0;
+	map->rm_root = NULL;
+	map->rm_head = NULL;
+	map->rm_tail = NULL;
+	return 0;
+}
+
+
+radixmapnode_t *
+radixmap_find(const radixmap_t *map, const char *key)
+{
+	if (!map || !key)
+		return NULL;
+
+	return radixmap_findn(map, key, strlen(key));
+}
+
+
+radixmapnode_t *
+radixmap_findn(const radixmap_t *map, const char *key, size_t keylen)
+{
+	size_t i, max, depth;
+	void *p;
+	void **slot;
+	struct radixinner *n;
+	struct radixmapnode *leaf;
+
+	if (!map || !key)
+		return NULL;
+
+	p = map->rm_root;
+	depth = 0;
+	while (p != NULL) {
+		if (RADIX_ISLEAF(p)) {
+			leaf = RADIX_LEAF(p);
+			return _radixmap_leafmatch(leaf, key, keylen) ?
+			       leaf : NULL;
+		}
+
+		/*
+		 * Only the stored part of the path is checked here,
+		 * the leaf compare at the end covers the rest.
+		 */
+		n = p;
+		max = _radixmap_min(n->rn_prefixlen, RADIX_MAXPREFIX);
+		for (i = 0; i < max; i++) {
+			if (n->rn_prefix[i] !=
+			    _radixmap_keybyte(key, keylen, depth + i))
+				return NULL;
+		}
+		depth += n->rn_prefixlen;
+		if (depth > keylen)
+			return NULL;
+
+		slot = _radixmap_findchild(n,
+			_radixmap_keybyte(key, keylen, depth));
+		p = slot ? *slot : NULL;
+		depth++;
+	}
+	return NULL;
+}
+
+
+radixmapnode_t *
+radixmap_first(const radixmap_t *map)
+{
+	if (!map)
+		return NULL;
+	return map->rm_head;
+}
+
+
+radixmapnode_t *
+radixmap_last(const radixmap_t *map)
+{
+	if (!map)
+		return NULL;
+	return map->rm_tail;
+}
+
+
+radixmapnode_t *
+radixmap_next(const radixmapnode_t *node)
+{
+	if (!node)
+		return NULL;
+	return node->rmn_link[1];
+}
+
+
+radixmapnode_t *
+radixmap_prev(const radixmapnode_t *node)
+{
+	if (!node)
+		return NULL;
+	return node->rmn_link[0];
+}
+
+
+int
+radixmap_prefix(const radixmap_t *map, const char *prefix,
+		radixmapnode_t **first, radixmapnode_t **last)
+{
+	size_t i, plen, depth;
+	void *p;
+	void **slot;
+	struct radixinner *n;
+	struct radixmapnode *leaf;
+
+	if (!map || !prefix || !first || !last)
+		return EINVAL;
+
+	plen = strlen(prefix);
+	p = map->rm_root;
+	depth = 0;
+	while (p != NULL) {
+		if (RADIX_ISLEAF(p)) {
+			leaf = RADIX_LEAF(p);
+			if (leaf->rmn_keylen < plen ||
+			    memcmp(leaf->rmn_key, prefix, plen) != 0)
+				return ENOENT;
+			*first = *last = leaf;
+			return 0;
+		}
+		if (depth >= plen)
+			break;
+
+		n = p;
+		leaf = NULL;
+		for (i = 0; i < n->rn_prefixlen && depth + i < plen; i++) {
+			unsigned char c;
+
+			if (i < RADIX_MAXPREFIX)
+				c = n->rn_prefix[i];
+			else {
+				if (leaf == NULL)
+					leaf = _radixmap_edgeleaf(n, 0);
+				c = leaf->rmn_key[depth + i];
+			}
+			if (c != (unsigned char)prefix[depth + i])
+				return ENOENT;
+		}
+		depth += n->rn_prefixlen;
+		if (depth >= plen)
+			break;
+
+		slot = _radixmap_findchild(n, prefix[depth]);
+		p = slot ? *slot : NULL;
+		depth++;
+	}
+	if (p == NULL)
+		return ENOENT;
+
+	/* everything below this subtree has the prefix */
+	*first = _radixmap_edgeleaf(p, 0);
+	*last = _radixmap_edgeleaf(p, 1);
+	return 0;
+}
+
+
+int
+radixmap_walk_prefix(const radixmap_t *map, const char *prefix,
+		     radixmap_walk_t cb, void *ctx)
+{
+	int err;
+	struct radixmapnode *node;
+	struct radixmapnode *first, *last;
+
+	if (!cb)
+		return EINVAL;
+
+	err = radixmap_prefix(map, prefix, &first, &last);
+	if (err == ENOENT)
+		return 0;
+	if (err != 0)
+		return err;
+
+	for (node = first;; node = node->rmn_link[1]) {
+		err = cb(node, ctx);
+		if (err != 0 || node == last)
+			return err;
+	}
+}
@@ -0,0 +1,299 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <map>
+#include <sys/stat.h>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+extern "C"
+{
+    #include <libcmap.h>
+}
+
+static std::map<std::string, std::string>
+contents(durablemap_t *dm)
+{
+    std::map<std::string, std::string> out;
+    const orderedmapnode_t *node;
+
+    durablemap_lock(dm);
+    for (node = orderedmap_first(durablemap_map(dm)); node != nullptr;
+         node = orderedmap_next(node))
+        out.emplace(std::string(node->omn_key, node->omn_keylen),
+                    std::string(node->omn_val, node->omn_vallen));
+    durablemap_unlock(dm);
+    return out;
+}
+
+static bool
+exists(const std::string &path)
+{
+    return access(path.c_str(), F_OK) == 0;
+}
+
+TEST_CASE("Durable map", "[durablemap]") {
+    char tmpl[] = "/tmp/test_durablemap.XXXXXX";
+    REQUIRE(mkdtemp(tmpl) != nullptr);
+    std::string dir(tmpl);
+    std::string path = dir + "/map";
+
+    SECTION("changes survive a reopen") {
+        durablemap_t dm;
+
+        REQUIRE(durablemap_open(&dm, path.c_str(), 0) == 0);
+        REQUIRE(durablemap_insert(&dm, "alpha", "1") == 0);
+        REQUIRE(durablemap_insert(&dm, "beta", "2") == 0);
+        REQUIRE(durablemap_insert(&dm, "alpha", "x") == EPERM);
+        REQUIRE(durablemap_set(&dm, "alpha", "one") == 0);
+        REQUIRE(durablemap_set(&dm, "gamma", "") == 0);
+        REQUIRE(durablemap_erase(&dm, "beta") == 0);
+        REQUIRE(durablemap_erase(&dm, "beta") == ENOENT);
+        REQUIRE(durablemap_close(&dm) == 0);
+
+        REQUIRE(durablemap_open(&dm, path.c_str(), 0) == 0);
+        REQUIRE(contents(&dm) == std::map<std::string, std::string>{
+            { "alpha", "one" }, { "gamma", "" } });
+        REQUIRE(durablemap_close(&dm) == 0);
+    }
+
+    SECTION("a torn record at the end of the log is dropped") {
+        durablemap_t dm;
+        int fd;
+
+        REQUIRE(durablemap_open(&dm, path.c_str(), 0) == 0);
+        REQUIRE(durablemap_insert(&dm, "kept", "yes") == 0);
+        REQUIRE(durablemap_close(&dm) == 0);
+
+        /* a header whose body never landed */
+        fd = open((path + ".log").c_str(), O_WRONLY | O_APPEND);
+        REQUIRE(fd >= 0);
+        REQUIRE(write(fd, "\x01\x02\x03\x04\x40\x00\x00\x00\x00\x00",
+                      10) == 10);
+        close(fd);
+
+        REQUIRE(durablemap_open(&dm, path.c_str(), 0) == 0);
+        REQUIRE(durablemap_insert(&dm, "after", "tear") == 0);
+        REQUIRE(durablemap_close(&dm) == 0);
+
+        REQUIRE(durablemap_open(&dm, path.c_str(), 0) == 0);
+        REQUIRE(contents(&dm) == std::map<std::string, std::string>{
+            { "after", "tear" }, { "kept", "yes" } });
+        REQUIRE(durablemap_close(&dm) == 0);
+    }
+
+    SECTION("a zero filled tail is dropped") {
+        durablemap_t dm;
+        int fd;
+        char zeros[64] = {};
+
+        REQUIRE(durablemap_open(&dm, path.c_str(), 0) == 0);
+        REQUIRE(durablemap_insert(&dm, "kept", "yes") == 0);
+        REQUIRE(durablemap_close(&dm) == 0);
+
+        fd = open((path + ".log").c_str(), O_WRONLY | O_APPEND);
+        REQUIRE(fd >= 0);
+        REQUIRE(write(fd, zeros, sizeof(zeros)) == sizeof(zeros));
+        close(fd);
+
+        REQUIRE(durablemap_open(&dm, path.c_str(), 0) == 0);
+        REQUIRE(contents(&dm) == std::map<std::string, std::string>{
+            { "kept", "yes" } });
+        REQUIRE(durablemap_close(&dm) == 0);
+    }
+
+    SECTION("a bad record inside the log fails the open") {
+        durablemap_t dm;
+        struct stat st, after;
+        int fd;
+
+        REQUIRE(durablemap_open(&dm, path.c_str(), 0) == 0);
+        REQUIRE(durablemap_insert(&dm, "first", "1") == 0);
+        REQUIRE(durablemap_insert(&dm, "second", "2") == 0);
+        REQUIRE(durablemap_close(&dm) == 0);
+        REQUIRE(stat((path + ".log").c_str(), &st) == 0);
+
+        /* flip the value byte of the first record */
+        fd = open((path + ".log").c_str(), O_WRONLY);
+        REQUIRE(fd >= 0);
+        REQUIRE(pwrite(fd, "X", 1, 8 + 9 + 5) == 1);
+        close(fd);
+
+        REQUIRE(durablemap_open(&dm, path.c_str(), 0) == EIO);
+        REQUIRE(durablemap_open(&dm, path.c_str(), 0) == EIO);
+        REQUIRE(stat((path + ".log").c_str(), &after) == 0);
+        REQUIRE(after.st_size == st.st_size);
+    }
+
+    SECTION("a bad length inside the log fails the open") {
+        durablemap_t dm;
+        struct stat st, after;
+        int fd;
+
+        REQUIRE(durablemap_open(&dm, path.c_str(), 0) == 0);
+        REQUIRE(durablemap_insert(&dm, "first", "1") == 0);
+        REQUIRE(durablemap_insert(&dm, "second", "2") == 0);
+        REQUIRE(durablemap_close(&dm) == 0);
+        REQUIRE(stat((path + ".log").c_str(), &st) == 0);
+
+        /* the first record now claims to run to the end of the file */
+        fd = open((path + ".log").c_str(), O_WRONLY);
+        REQUIRE(fd >= 0);
+        REQUIRE(pwrite(fd, "\x7f", 1, 4) == 1);
+        close(fd);
+
+        REQUIRE(durablemap_open(&dm, path.c_str(), 0) == EIO);
+        REQUIRE(stat((path + ".log").c_str(), &after) == 0);
+        REQUIRE(after.st_size == st.st_size);
+    }
+
+    SECTION("a bad record in the old log keeps it") {
+        durablemap_t dm;
+        int fd;
+
+        REQUIRE(durablemap_open(&dm, path.c_str(), 0) == 0);
+        REQUIRE(durablemap_insert(&dm, "old", "1") == 0);
+        REQUIRE(durablemap_close(&dm) == 0);
+        REQUIRE(rename((path + ".log").c_str(),
+                       (path + ".log.old").c_str()) == 0);
+
+        /* even a torn looking end is corruption in a rotated log */
+        fd = open((path + ".log.old").c_str(), O_WRONLY | O_APPEND);
+        REQUIRE(fd >= 0);
+        REQUIRE(write(fd, "\x01\x02\x03\x04\x40\x00\x00\x00\x01", 9) == 9);
+        close(fd);
+
+        REQUIRE(durablemap_open(&dm, path.c_str(), 0) == EIO);
+        REQUIRE(exists(path + ".log.old"));
+        REQUIRE_FALSE(exists(path + ".snap"));
+    }
+
+    SECTION("compaction folds the log into a snapshot") {
+        durablemap_t dm;
+        std::map<std::string, std::string> expect;
+
+        REQUIRE(durablemap_open(&dm, path.c_str(), 0) == 0);
+        for (int i = 0; i < 100; i++) {
+            std::string key = "key" + std::to_string(i % 10);
+            std::string val = "val" + std::to_string(i);
+
+            REQUIRE(durablemap_set(&dm, key.c_str(), val.c_str()) == 0);
+            expect[key] = val;
+        }
+        REQUIRE(durablemap_compact(&dm) == 0);
+        REQUIRE(exists(path + ".snap"));
+        REQUIRE_FALSE(exists(path + ".log.old"));
+        REQUIRE(durablemap_erase(&dm, "key3") == 0);
+        expect.erase("key3");
+        REQUIRE(durablemap_close(&dm) == 0);
+
+        REQUIRE(durablemap_open(&dm, path.c_str(), 0) == 0);
+        REQUIRE(contents(&dm) == expect);
+        REQUIRE(durablemap_close(&dm) == 0);
+    }
+
+    SECTION("a snapshot taken in chunks keeps concurrent changes") {
+        durablemap_t dm;
+        std::map<std::string, std::string> expect;
+        std::string big(100 * 1024, 'b');
+        std::string pad(100, 'p');
+
+        /* several chunks of records and one larger than a chunk */
+        REQUIRE(durablemap_open(&dm, path.c_str(), SIZE_MAX) == 0);
+        for (int i = 0; i < 4000; i++) {
+            std::string key = "k" + std::to_string(i);
+
+            REQUIRE(durablemap_set(&dm, key.c_str(), pad.c_str()) == 0);
+            expect[key] = pad;
+        }
+        REQUIRE(durablemap_set(&dm, "k2000x", big.c_str()) == 0);
+        expect["k2000x"] = big;
+
+        int cerr = 0;
+        std::thread compactor([&dm, &cerr] {
+            for (int n = 0; n < 3 && cerr == 0; n++)
+                cerr = durablemap_compact(&dm);
+        });
+        for (int i = 0; i < 4000; i += 7) {
+            std::string key = "k" + std::to_string(i);
+
+            if (i % 2 == 0) {
+                REQUIRE(durablemap_erase(&dm, key.c_str()) == 0);
+                expect.erase(key);
+            } else {
+                REQUIRE(durablemap_set(&dm, key.c_str(), "new") == 0);
+                expect[key] = "new";
+            }
+        }
+        compactor.join();
+        REQUIRE(cerr == 0);
+        REQUIRE(contents(&dm) == expect);
+        REQUIRE(durablemap_close(&dm) == 0);
+
+        REQUIRE(durablemap_open(&dm, path.c_str(), SIZE_MAX) == 0);
+        REQUIRE(contents(&dm) == expect);
+        REQUIRE(durablemap_close(&dm) == 0);
+    }
+
+    SECTION("an interrupted compaction is finished on open") {
+        durablemap_t dm;
+
+        REQUIRE(durablemap_open(&dm, path.c_str(), 0) == 0);
+        REQUIRE(durablemap_set(&dm, "old", "1") == 0);
+        REQUIRE(durablemap_close(&dm) == 0);
+
+        /* crash after the log was rotated but before the snapshot */
+        REQUIRE(rename((path + ".log").c_str(),
+                       (path + ".log.old").c_str()) == 0);
+
+        REQUIRE(durablemap_open(&dm, path.c_str(), 0) == 0);
+        REQUIRE_FALSE(exists(path + ".log.old"));
+        REQUIRE(durablemap_set(&dm, "new", "2") == 0);
+        REQUIRE(durablemap_close(&dm) == 0);
+
+        REQUIRE(durablemap_open(&dm, path.c_str(), 0) == 0);
+        REQUIRE(contents(&dm) == std::map<std::string, std::string>{
+            { "new", "2" }, { "old", "1" } });
+        REQUIRE(durablemap_close(&dm) == 0);
+    }
+
+    SECTION("concurrent writers with background compaction") {
+        durablemap_t dm;
+        std::vector<std::thread> threads;
+        const int nthreads = 4, nkeys = 200;
+
+        REQUIRE(durablemap_open(&dm, path.c_str(), 1024) == 0);
+        for (int t = 0; t < nthreads; t++) {
+            threads.emplace_back([&dm, t] {
+                for (int i = 0; i < nkeys; i++) {
+                    std::string key = std::to_string(t) + "/" +
+                                      std::to_string(i);
+                    durablemap_set(&dm, key.c_str(), "v");
+                    if (i % 4 == 0)
+                        durablemap_erase(&dm, key.c_str());
+                }
+            });
+        }
+        for (auto &thread : threads)
+            thread.join();
+        REQUIRE(contents(&dm).size() == nthreads * nkeys * 3 / 4);
+        REQUIRE(durablemap_close(&dm) == 0);
+
+        REQUIRE(durablemap_open(&dm, path.c_str(), 1024) == 0);
+        auto got = contents(&dm);
+        REQUIRE(got.size() == nthreads * nkeys * 3 / 4);
+        REQUIRE(got.count("0/0") == 0);
+        REQUIRE(got.count("3/199") == 1);
+        REQUIRE(durablemap_close(&dm) == 0);
+    }
+
+    for (const char *suffix : { ".snap", ".snap.tmp", ".log", ".log.old" })
+        unlink((path + suffix).c_str());
+    rmdir(dir.c_str());
+}
@@ -0,0 +1,131 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+extern "C"
+{
+    #include <libcmap.h>
+}
+
+TEST_CASE("Intern pool", "[internpool]") {
+
+    SECTION("init") {
+        internpool_t pool;
+
+        REQUIRE(internpool_init(&pool) == 0);
+        REQUIRE(internpool_destroy(&pool) == 0);
+    }
+
+    SECTION("handles are shared and reference counted") {
+        internpool_t pool;
+        const char *a, *b, *c;
+
+        REQUIRE(internpool_init(&pool) == 0);
+        a = internpool_intern(&pool, "timeout.ms", 7);
+        b = internpool_intern(&pool, "timeout", 7);
+        c = internpool_intern(&pool, "retries", 7);
+        REQUIRE(a != nullptr);
+        REQUIRE(a == b);
+        REQUIRE(a != c);
+        REQUIRE(strcmp(a, "timeout") == 0);
+        REQUIRE(internpool_count(&pool) == 2);
+
+        internpool_release(&pool, a);
+        REQUIRE(internpool_count(&pool) == 2);
+        REQUIRE(internpool_destroy(&pool) == EBUSY);
+        internpool_release(&pool, b);
+        internpool_release(&pool, c);
+        REQUIRE(internpool_count(&pool) == 0);
+        REQUIRE(internpool_destroy(&pool) == 0);
+    }
+
+    SECTION("maps share the key storage") {
+        internpool_t pool;
+        orderedmap_t maps[8];
+        orderedmapnode_t *node;
+
+        REQUIRE(internpool_init(&pool) == 0);
+        for (auto &map : maps) {
+            REQUIRE(orderedmap_init(&map) == 0);
+            REQUIRE(orderedmap_bind_pool(&map, &pool) == 0);
+            for (int i = 0; i < 100; i++) {
+                std::string key = "setting." + std::to_string(i);
+                REQUIRE(orderedmap_insert(&map, key.c_str(), "v") == 0);
+            }
+        }
+        REQUIRE(internpool_count(&pool) == 100);
+
+        /* the same key in two maps is the same handle */
+        node = orderedmap_find(&maps[0], "setting.42");
+        REQUIRE(node != nullptr);
+        REQUIRE(node->omn_key == orderedmap_find(&maps[7],
+                                                 "setting.42")->omn_key);
+        REQUIRE(orderedmap_find(&maps[3], node->omn_key) != nullptr);
+        REQUIRE(orderedmap_bind_pool(&maps[0], nullptr) == EBUSY);
+
+        REQUIRE(orderedmap_erase(&maps[0], "setting.42") == 0);
+        REQUIRE(internpool_count(&pool) == 100);
+        for (auto &map : maps)
+            REQUIRE(orderedmap_destroy(&map) == 0);
+        REQUIRE(internpool_count(&pool) == 0);
+        REQUIRE(internpool_destroy(&pool) == 0);
+    }
+
+    SECTION("pooled nodes do not carry the key") {
+        internpool_t pool;
+        orderedmap_t copied, pooled;
+        orderedmap_usage_t cu, pu;
+        size_t keybytes = 0;
+
+        REQUIRE(internpool_init(&pool) == 0);
+        REQUIRE(orderedmap_init(&copied) == 0);
+        REQUIRE(orderedmap_init(&pooled) == 0);
+        REQUIRE(orderedmap_bind_pool(&pooled, &pool) == 0);
+        for (int i = 0; i < 1000; i++) {
+            std::string key = "sensor/room-" + std::to_string(i) + "/temp";
+            REQUIRE(orderedmap_insert(&copied, key.c_str(), "21.5") == 0);
+            REQUIRE(orderedmap_insert(&pooled, key.c_str(), "21.5") == 0);
+            keybytes += key.size() + 1;
+        }
+
+        /* each node saves exactly its key and terminator */
+        REQUIRE(orderedmap_memory_usage(&copied, &cu) == 0);
+        REQUIRE(orderedmap_memory_usage(&pooled, &pu) == 0);
+        REQUIRE(cu.omu_numnodes == pu.omu_numnodes);
+        REQUIRE(cu.omu_nodebytes - pu.omu_nodebytes == keybytes);
+
+        REQUIRE(orderedmap_destroy(&copied) == 0);
+        REQUIRE(orderedmap_destroy(&pooled) == 0);
+        REQUIRE(internpool_destroy(&pool) == 0);
+    }
+
+    SECTION("concurrent intern and release") {
+        internpool_t pool;
+        std::vector<std::thread> threads;
+
+        REQUIRE(internpool_init(&pool) == 0);
+        for (int t = 0; t < 4; t++) {
+            threads.emplace_back([&pool]() {
+                for (int n = 0; n < 20; n++) {
+                    std::vector<const char *> handles;
+
+                    for (int i = 0; i < 500; i++) {
+                        std::string key = "key" + std::to_string(i);
+                        handles.push_back(internpool_intern(&pool,
+                                                            key.data(),
+                                                            key.size()));
+                    }
+                    for (const char *handle : handles)
+                        internpool_release(&pool, handle);
+                }
+            });
+        }
+        for (auto &thread : threads)
+            thread.join();
+        REQUIRE(internpool_count(&pool) == 0);
+        REQUIRE(internpool_destroy(&pool) == 0);
+    }
+}
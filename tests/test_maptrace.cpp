@@ -0,0 +1,173 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+extern "C"
+{
+    #include <libcmap.h>
+}
+
+struct traced {
+    maptrace_optype_t type;
+    std::string key;
+    size_t keyid;
+    size_t vallen;
+
+    bool operator==(const traced &) const = default;
+};
+
+static std::vector<traced>
+read_trace(const std::string &path, int *errp)
+{
+    maptrace_reader_t reader;
+    maptrace_op_t op;
+    std::vector<traced> out;
+
+    *errp = maptrace_reader_open(&reader, path.c_str());
+    if (*errp != 0)
+        return out;
+    while ((*errp = maptrace_read(&reader, &op)) == 0)
+        out.push_back({ op.mto_type,
+                        op.mto_key ? std::string(op.mto_key, op.mto_keylen)
+                                   : std::string(),
+                        op.mto_keyid, op.mto_vallen });
+    maptrace_reader_close(&reader);
+    return out;
+}
+
+TEST_CASE("Map trace", "[maptrace]") {
+    char tmpl[] = "/tmp/test_maptrace.XXXXXX";
+    int fd = mkstemp(tmpl);
+    REQUIRE(fd >= 0);
+    close(fd);
+    std::string path(tmpl);
+    int err;
+
+    SECTION("operations are recorded with key ids") {
+        maptrace_t trace;
+        orderedmap_t map;
+
+        REQUIRE(maptrace_open(&trace, path.c_str()) == 0);
+        REQUIRE(orderedmap_init(&map) == 0);
+        REQUIRE(orderedmap_insert(&map, "untraced", "1") == 0);
+        REQUIRE(orderedmap_trace(&map, &trace) == 0);
+
+        REQUIRE(orderedmap_insert(&map, "alpha", "value") == 0);
+        REQUIRE(orderedmap_insertn(&map, "b\0c", 3, "", 0) == 0);
+        REQUIRE(orderedmap_find(&map, "alpha") != nullptr);
+        REQUIRE(orderedmap_find(&map, "missing") == nullptr);
+        REQUIRE(orderedmap_erase(&map, "alpha") == 0);
+        REQUIRE(orderedmap_erase_node(&map,
+                    orderedmap_findn(&map, "b\0c", 3)) == 0);
+        REQUIRE(orderedmap_clear(&map) == 0);
+        REQUIRE(orderedmap_insert(&map, "alpha", "again") == 0);
+        REQUIRE(trace.mt_numops == 9);
+        REQUIRE(trace.mt_numkeys == 3);
+
+        /* teardown is not recorded and the trace can go first */
+        REQUIRE(maptrace_close(&trace) == 0);
+        REQUIRE(orderedmap_destroy(&map) == 0);
+
+        std::string bc("b\0c", 3);
+        std::vector<traced> ops = read_trace(path, &err);
+        REQUIRE(err == ENOENT);
+        REQUIRE(ops == std::vector<traced>{
+            { MAPTRACE_INSERT, "alpha", 0, 5 },
+            { MAPTRACE_INSERT, bc, 1, 0 },
+            { MAPTRACE_FIND, "alpha", 0, 0 },
+            { MAPTRACE_FIND, "missing", 2, 0 },
+            { MAPTRACE_ERASE, "alpha", 0, 0 },
+            { MAPTRACE_FIND, bc, 1, 0 },
+            { MAPTRACE_ERASE, bc, 1, 0 },
+            { MAPTRACE_CLEAR, "", 0, 0 },
+            { MAPTRACE_INSERT, "alpha", 0, 5 },
+        });
+    }
+
+    SECTION("composite calls are recorded as what they do") {
+        maptrace_t trace;
+        orderedmap_t map, oldmap, newmap;
+        orderedmap_t *child;
+        orderedmap_patch_t patch;
+
+        REQUIRE(orderedmap_init(&oldmap) == 0);
+        REQUIRE(orderedmap_init(&newmap) == 0);
+        REQUIRE(orderedmap_insert(&oldmap, "k", "long value") == 0);
+        REQUIRE(orderedmap_insert(&newmap, "k", "short") == 0);
+        REQUIRE(orderedmap_patch_init(&patch) == 0);
+        REQUIRE(orderedmap_diff(&oldmap, &newmap, orderedmap_patch_record,
+                                &patch) == 0);
+
+        REQUIRE(maptrace_open(&trace, path.c_str()) == 0);
+        REQUIRE(orderedmap_init(&map) == 0);
+        REQUIRE(orderedmap_insert(&map, "k", "long value") == 0);
+        REQUIRE(orderedmap_trace(&map, &trace) == 0);
+
+        /* only lookups in the traced map itself are recorded */
+        REQUIRE(orderedmap_insert_map(&map, "t", &child) == 0);
+        REQUIRE(orderedmap_insert(child, "leaf", "1") == 0);
+        REQUIRE(orderedmap_find_path(&map, "t.leaf") != nullptr);
+        const char *segs[] = { "t", "leaf" };
+        REQUIRE(orderedmap_find_path_v(&map, segs, 2) != nullptr);
+
+        /* a value replaced in place */
+        REQUIRE(orderedmap_apply_patch(&map, &patch) == 0);
+        REQUIRE(orderedmap_trace(&map, nullptr) == 0);
+        REQUIRE(maptrace_close(&trace) == 0);
+
+        std::vector<traced> ops = read_trace(path, &err);
+        REQUIRE(err == ENOENT);
+        REQUIRE(ops == std::vector<traced>{
+            { MAPTRACE_INSERT, "t", 0, 0 },
+            { MAPTRACE_FIND, "t", 0, 0 },
+            { MAPTRACE_FIND, "t", 0, 0 },
+            { MAPTRACE_FIND, "k", 1, 0 },
+            { MAPTRACE_ERASE, "k", 1, 0 },
+            { MAPTRACE_INSERT, "k", 1, 5 },
+        });
+        REQUIRE(strcmp(orderedmap_find(&map, "k")->omn_val, "short") == 0);
+
+        REQUIRE(orderedmap_patch_destroy(&patch) == 0);
+        REQUIRE(orderedmap_destroy(&map) == 0);
+        REQUIRE(orderedmap_destroy(&oldmap) == 0);
+        REQUIRE(orderedmap_destroy(&newmap) == 0);
+    }
+
+    SECTION("a damaged trace is reported") {
+        maptrace_t trace;
+        FILE *fp;
+        long size;
+
+        REQUIRE(maptrace_open(&trace, path.c_str()) == 0);
+        for (int i = 0; i < 300; i++)
+            maptrace_record(&trace, MAPTRACE_INSERT,
+                            std::to_string(i).c_str(),
+                            std::to_string(i).size(), i * 1000);
+        REQUIRE(maptrace_close(&trace) == 0);
+        REQUIRE(read_trace(path, &err).size() == 300);
+        REQUIRE(err == ENOENT);
+
+        /* cut the last record in the middle of the value length */
+        fp = fopen(path.c_str(), "r+");
+        REQUIRE(fp != nullptr);
+        fseek(fp, 0, SEEK_END);
+        size = ftell(fp);
+        fclose(fp);
+        REQUIRE(truncate(path.c_str(), size - 1) == 0);
+        REQUIRE(read_trace(path, &err).size() == 299);
+        REQUIRE(err == EIO);
+
+        fp = fopen(path.c_str(), "w");
+        fputs("not a trace", fp);
+        fclose(fp);
+        read_trace(path, &err);
+        REQUIRE(err == EINVAL);
+    }
+
+    unlink(path.c_str());
+}
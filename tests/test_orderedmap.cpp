@@ -1,5 +1,13 @@
 #include <catch2/catch_test_macros.hpp>
 
+#include <cstdio>
+#include <cstdlib>
+#include <cstddef>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
 extern "C"
 {
     #include <libcmap.h>
@@ -13,4 +21,705 @@ TEST_CASE("Ordered map", "[orderedmap]") {
         REQUIRE(orderedmap_init(&map) == 0);
         REQUIRE(orderedmap_destroy(&map) == 0);
     }
+
+    SECTION("insert find erase") {
+        orderedmap_t map;
+        orderedmapnode_t *node;
+
+        REQUIRE(orderedmap_init(&map) == 0);
+        REQUIRE(orderedmap_insert(&map, "b", "2") == 0);
+        REQUIRE(orderedmap_insert(&map, "a", "1") == 0);
+        REQUIRE(orderedmap_insert(&map, "c", "3") == 0);
+        REQUIRE(orderedmap_insert(&map, "a", "x") == EPERM);
+        REQUIRE(map.om_numnodes == 3);
+
+        node = orderedmap_find(&map, "a");
+        REQUIRE(node != nullptr);
+        REQUIRE(strcmp(node->omn_val, "1") == 0);
+        REQUIRE(orderedmap_find(&map, "d") == nullptr);
+
+        REQUIRE(orderedmap_erase(&map, "a") == 0);
+        REQUIRE(orderedmap_erase(&map, "a") == ENOENT);
+        REQUIRE(orderedmap_find(&map, "a") == nullptr);
+        REQUIRE(orderedmap_destroy(&map) == 0);
+    }
+
+    SECTION("ordering matches std::map") {
+        orderedmap_t map;
+        orderedmapnode_t *node;
+        std::map<std::string, std::string> ref;
+
+        REQUIRE(orderedmap_init(&map) == 0);
+        for (int i = 0; i < 2000; i++) {
+            std::string key = "key" + std::to_string((i * 7919) % 1000);
+            std::string val = std::to_string(i);
+
+            if ((i % 3) == 2) {
+                REQUIRE(orderedmap_erase(&map, key.c_str()) ==
+                        (ref.erase(key) ? 0 : ENOENT));
+                continue;
+            }
+            bool added = ref.emplace(key, val).second;
+            REQUIRE(orderedmap_insert(&map, key.c_str(), val.c_str()) ==
+                    (added ? 0 : EPERM));
+        }
+
+        REQUIRE(map.om_numnodes == (int)ref.size());
+        node = orderedmap_first(&map);
+        for (const auto &[key, val] : ref) {
+            REQUIRE(node != nullptr);
+            REQUIRE(key == node->omn_key);
+            REQUIRE(val == node->omn_val);
+            node = orderedmap_next(node);
+        }
+        REQUIRE(node == nullptr);
+
+        node = orderedmap_last(&map);
+        for (auto it = ref.rbegin(); it != ref.rend(); ++it) {
+            REQUIRE(node != nullptr);
+            REQUIRE(it->first == node->omn_key);
+            node = orderedmap_prev(node);
+        }
+        REQUIRE(node == nullptr);
+        REQUIRE(orderedmap_destroy(&map) == 0);
+    }
+
+    SECTION("case comparator") {
+        orderedmap_t map;
+        orderedmapnode_t *node;
+
+        REQUIRE(orderedmap_init_cmp(&map, orderedmap_cmp_case, NULL) == 0);
+        REQUIRE(orderedmap_insert(&map, "Content-Type", "text") == 0);
+        REQUIRE(orderedmap_insert(&map, "content-type", "html") == EPERM);
+
+        node = orderedmap_find(&map, "CONTENT-TYPE");
+        REQUIRE(node != nullptr);
+        REQUIRE(strcmp(node->omn_key, "Content-Type") == 0);
+        REQUIRE(orderedmap_destroy(&map) == 0);
+    }
+
+    SECTION("natural comparator") {
+        orderedmap_t map;
+        orderedmapnode_t *node;
+        const char *order[] = { "item2", "item9", "item10", "item010",
+                                "item100", "itemb" };
+
+        REQUIRE(orderedmap_init_cmp(&map, orderedmap_cmp_natural,
+                                    NULL) == 0);
+        for (int i = 5; i >= 0; i--)
+            REQUIRE(orderedmap_insert(&map, order[i], "") == 0);
+
+        node = orderedmap_first(&map);
+        for (const char *key : order) {
+            REQUIRE(node != nullptr);
+            REQUIRE(strcmp(node->omn_key, key) == 0);
+            node = orderedmap_next(node);
+        }
+        REQUIRE(node == nullptr);
+        REQUIRE(orderedmap_destroy(&map) == 0);
+    }
+}
+
+/* check the red black rules and links, returns the black height */
+static int
+check_tree(const orderedmapnode_t *node, const orderedmapnode_t *parent)
+{
+    int left, right;
+
+    if (node == nullptr)
+        return 1;
+    REQUIRE(node->omn_parent == parent);
+    if (node->omn_color == orderedmapnode_t::OMN_RED) {
+        REQUIRE((node->omn_child[0] == nullptr ||
+                 node->omn_child[0]->omn_color != orderedmapnode_t::OMN_RED));
+        REQUIRE((node->omn_child[1] == nullptr ||
+                 node->omn_child[1]->omn_color != orderedmapnode_t::OMN_RED));
+    }
+    left = check_tree(node->omn_child[0], node);
+    right = check_tree(node->omn_child[1], node);
+    REQUIRE(left == right);
+    return left + (node->omn_color == orderedmapnode_t::OMN_BLACK);
+}
+
+static void
+check_map(const orderedmap_t *map, const std::map<std::string, std::string> &ref)
+{
+    const orderedmapnode_t *node;
+
+    check_tree(map->om_root, nullptr);
+    REQUIRE(map->om_numnodes == (int)ref.size());
+    node = orderedmap_first(map);
+    for (const auto &[key, val] : ref) {
+        REQUIRE(node != nullptr);
+        REQUIRE(key == std::string(node->omn_key, node->omn_keylen));
+        node = orderedmap_next(node);
+    }
+    REQUIRE(node == nullptr);
+
+    /* the cached rightmost node is the real one */
+    node = map->om_root;
+    while (node != nullptr && node->omn_child[1] != nullptr)
+        node = node->omn_child[1];
+    REQUIRE(orderedmap_last(map) == node);
+}
+
+TEST_CASE("Ordered map hinted insert", "[orderedmap]") {
+    orderedmap_t map;
+    orderedmapnode_t *hint;
+    std::map<std::string, std::string> ref;
+    char key[16];
+
+    REQUIRE(orderedmap_init(&map) == 0);
+
+    SECTION("sorted append") {
+        for (int i = 0; i < 1000; i++) {
+            snprintf(key, sizeof(key), "%08d", i);
+            REQUIRE(orderedmap_insert(&map, key, "v") == 0);
+            ref.emplace(key, "v");
+            REQUIRE(orderedmap_last(&map) == orderedmap_find(&map, key));
+        }
+        check_map(&map, ref);
+
+        /* erasing the tail moves the cached node back */
+        REQUIRE(orderedmap_erase(&map, "00000999") == 0);
+        ref.erase("00000999");
+        REQUIRE(strcmp(orderedmap_last(&map)->omn_key, "00000998") == 0);
+
+        /* a value too long to rewrite in place replaces the node */
+        orderedmap_t other;
+        REQUIRE(orderedmap_init(&other) == 0);
+        REQUIRE(orderedmap_insert(&other, "00000998", "longer value") == 0);
+        REQUIRE(orderedmap_update(&map, &other) == 0);
+        REQUIRE(orderedmap_destroy(&other) == 0);
+        REQUIRE(orderedmap_last(&map) == orderedmap_find(&map, "00000998"));
+        REQUIRE(strcmp(orderedmap_last(&map)->omn_val, "longer value") == 0);
+        check_map(&map, ref);
+    }
+
+    SECTION("cursor through descending and clustered keys") {
+        hint = nullptr;
+        for (int i = 999; i >= 0; i--) {
+            snprintf(key, sizeof(key), "%08d", i);
+            REQUIRE(orderedmap_insert_hint(&map, &hint, key, "v") == 0);
+            REQUIRE(strcmp(hint->omn_key, key) == 0);
+            ref.emplace(key, "v");
+        }
+        check_map(&map, ref);
+
+        /* fill the gaps between existing keys from a moving cursor */
+        hint = orderedmap_first(&map);
+        for (int i = 0; i < 1000; i += 3) {
+            snprintf(key, sizeof(key), "%08d5", i);
+            REQUIRE(orderedmap_insert_hint(&map, &hint, key, "g") == 0);
+            ref.emplace(key, "g");
+        }
+        check_map(&map, ref);
+
+        /* a duplicate returns the existing node as the cursor */
+        hint = orderedmap_first(&map);
+        REQUIRE(orderedmap_insert_hint(&map, &hint, "00000500", "x") == EPERM);
+        REQUIRE(strcmp(hint->omn_key, "00000500") == 0);
+        REQUIRE(strcmp(hint->omn_val, "v") == 0);
+    }
+
+    SECTION("bad hints fall back to a full lookup") {
+        for (int i = 0; i < 2000; i++) {
+            int k = (i * 7919) % 1000;
+
+            snprintf(key, sizeof(key), "%d", k);
+            hint = orderedmap_find(&map, std::to_string((k * 31) % 1000).c_str());
+            bool added = ref.emplace(key, "v").second;
+            REQUIRE(orderedmap_insert_hint(&map, &hint, key, "v") ==
+                    (added ? 0 : EPERM));
+            REQUIRE(strcmp(hint->omn_key, key) == 0);
+        }
+        check_map(&map, ref);
+    }
+
+    REQUIRE(orderedmap_destroy(&map) == 0);
+}
+
+TEST_CASE("Ordered map compaction", "[orderedmap]") {
+    orderedmap_t map;
+    orderedmap_usage_t usage;
+    orderedmapnode_t *node, *prev;
+    std::map<std::string, std::string> ref;
+    std::string val;
+
+    REQUIRE(orderedmap_init(&map) == 0);
+    for (int i = 0; i < 4000; i++) {
+        std::string key = "key" + std::to_string((i * 7919) % 3000);
+
+        if ((i % 4) == 3) {
+            orderedmap_erase(&map, key.c_str());
+            ref.erase(key);
+            continue;
+        }
+        val = std::string(i % 50, 'v');
+        if (ref.emplace(key, val).second)
+            REQUIRE(orderedmap_insert(&map, key.c_str(), val.c_str()) == 0);
+    }
+
+    REQUIRE(orderedmap_memory_usage(&map, &usage) == 0);
+    REQUIRE(usage.omu_numnodes == ref.size());
+    REQUIRE(usage.omu_blocknodes == 0);
+    REQUIRE(usage.omu_numblocks == 0);
+
+    SECTION("full pass packs the nodes in key order") {
+        REQUIRE(orderedmap_compact(&map) == 0);
+        check_map(&map, ref);
+
+        REQUIRE(orderedmap_memory_usage(&map, &usage) == 0);
+        REQUIRE(usage.omu_blocknodes == ref.size());
+        REQUIRE(usage.omu_numblocks > 0);
+        REQUIRE(usage.omu_blockbytes >= usage.omu_nodebytes);
+
+        /* the next node follows in memory unless a new block starts */
+        int jumps = 0;
+        prev = orderedmap_first(&map);
+        for (node = orderedmap_next(prev); node != nullptr;
+             prev = node, node = orderedmap_next(node)) {
+            REQUIRE(node->omn_block != nullptr);
+            if (node->omn_block != prev->omn_block)
+                jumps++;
+            else
+                REQUIRE((char *)node > (char *)prev);
+            REQUIRE(strcmp(node->omn_val,
+                           ref[node->omn_key].c_str()) == 0);
+        }
+        REQUIRE(jumps == (int)usage.omu_numblocks - 1);
+
+        /* a value shrunk in place is slack, not dead space */
+        orderedmap_t longer, shorter;
+        orderedmap_patch_t patch;
+        orderedmap_usage_t before;
+        const std::string &key = ref.rbegin()->first;
+        std::string big(200, 'L');
+
+        REQUIRE(orderedmap_init(&longer) == 0);
+        REQUIRE(orderedmap_init(&shorter) == 0);
+        REQUIRE(orderedmap_insert(&longer, key.c_str(), big.c_str()) == 0);
+        REQUIRE(orderedmap_insert(&shorter, key.c_str(), "s") == 0);
+        REQUIRE(orderedmap_patch_init(&patch) == 0);
+        REQUIRE(orderedmap_diff(&longer, &shorter, orderedmap_patch_record,
+                                &patch) == 0);
+        REQUIRE(orderedmap_erase(&map, key.c_str()) == 0);
+        REQUIRE(orderedmap_insert(&map, key.c_str(), big.c_str()) == 0);
+        REQUIRE(orderedmap_compact(&map) == 0);
+        ref[key] = big;
+
+        REQUIRE(orderedmap_memory_usage(&map, &before) == 0);
+        REQUIRE(before.omu_slackbytes == 0);
+        node = orderedmap_find(&map, key.c_str());
+        REQUIRE(orderedmap_apply_patch(&map, &patch) == 0);
+        REQUIRE(orderedmap_find(&map, key.c_str()) == node);
+        ref[key] = "s";
+        REQUIRE(orderedmap_memory_usage(&map, &usage) == 0);
+        REQUIRE(usage.omu_deadbytes == before.omu_deadbytes);
+        REQUIRE(usage.omu_slackbytes + alignof(std::max_align_t) >=
+                big.size() - 1);
+        REQUIRE(usage.omu_nodebytes == before.omu_nodebytes - big.size() + 1);
+        REQUIRE(orderedmap_patch_destroy(&patch) == 0);
+        REQUIRE(orderedmap_destroy(&longer) == 0);
+        REQUIRE(orderedmap_destroy(&shorter) == 0);
+
+        /* the erased node frees everything it was given */
+        size_t given = node->omn_blocksize;
+        REQUIRE(orderedmap_erase(&map, key.c_str()) == 0);
+        ref.erase(key);
+        REQUIRE(orderedmap_memory_usage(&map, &before) == 0);
+        REQUIRE(before.omu_slackbytes == 0);
+        REQUIRE(before.omu_deadbytes == usage.omu_deadbytes + given);
+        usage = before;
+
+        /* erased nodes leave dead space until the block is unused */
+        size_t dead = usage.omu_deadbytes;
+        for (auto it = ref.begin(); it != ref.end();) {
+            REQUIRE(orderedmap_erase(&map, it->first.c_str()) == 0);
+            it = ref.erase(it);
+            if (it != ref.end())
+                ++it;
+        }
+        REQUIRE(orderedmap_memory_usage(&map, &usage) == 0);
+        REQUIRE(usage.omu_deadbytes > dead);
+
+        /* changes after a pass still work on packed nodes */
+        REQUIRE(orderedmap_update_int(&map, "key1", 12345) == 0);
+        REQUIRE(orderedmap_insert(&map, "new", "node") == 0);
+        ref["key1"] = "12345";
+        ref["new"] = "node";
+        check_map(&map, ref);
+    }
+
+    SECTION("incremental passes survive changes in between") {
+        int steps = 0, err;
+
+        while ((err = orderedmap_compact_step(&map, 64)) == EAGAIN) {
+            std::string key = "step" + std::to_string(steps++);
+
+            /* erase the node the pass is about to move */
+            if (map.om_compactnext != nullptr) {
+                std::string next(map.om_compactnext->omn_key,
+                                 map.om_compactnext->omn_keylen);
+                REQUIRE(orderedmap_erase(&map, next.c_str()) == 0);
+                ref.erase(next);
+            }
+            REQUIRE(orderedmap_insert(&map, key.c_str(), "x") == 0);
+            ref.emplace(key, "x");
+            check_map(&map, ref);
+        }
+        REQUIRE(err == 0);
+        REQUIRE(steps > 1);
+        check_map(&map, ref);
+    }
+
+    SECTION("clear in the middle of a pass") {
+        REQUIRE(orderedmap_compact_step(&map, 10) == EAGAIN);
+        REQUIRE(orderedmap_clear(&map) == 0);
+        REQUIRE(map.om_blocks == nullptr);
+        REQUIRE(orderedmap_compact_step(&map, 10) == 0);
+        ref.clear();
+    }
+
+    SECTION("a table pointer stays valid while its node moves") {
+        orderedmap_t *child;
+        int err;
+
+        REQUIRE(orderedmap_insert_map(&map, "key0/t", &child) == 0);
+        REQUIRE(orderedmap_insert(child, "a", "1") == 0);
+        node = orderedmap_find(&map, "key0/t");
+
+        /* the table is used between steps, one of which moves its node */
+        while ((err = orderedmap_compact_step(&map, 16)) == EAGAIN)
+            REQUIRE(orderedmap_insert(child, ("s" + std::to_string(
+                child->om_numnodes)).c_str(), "x") == 0);
+        REQUIRE(err == 0);
+        REQUIRE(orderedmap_find(&map, "key0/t") != node);
+        REQUIRE(orderedmap_getmap(orderedmap_find(&map, "key0/t")) == child);
+        REQUIRE(orderedmap_insert(child, "b", "2") == 0);
+        REQUIRE(orderedmap_find_path(&map, "key0/t.b") != nullptr);
+        REQUIRE(strcmp(orderedmap_find(child, "a")->omn_val, "1") == 0);
+        REQUIRE(orderedmap_erase(&map, "key0/t") == 0);
+    }
+
+    SECTION("nested tables and pooled keys move with their nodes") {
+        internpool_t pool;
+        orderedmap_t pooled;
+        orderedmap_t *child;
+
+        REQUIRE(orderedmap_insert_map(&map, "zz", &child) == 0);
+        REQUIRE(orderedmap_insert(child, "inner", "1") == 0);
+        REQUIRE(orderedmap_compact(&map) == 0);
+        REQUIRE(orderedmap_compact(orderedmap_getmap(
+            orderedmap_find(&map, "zz"))) == 0);
+        node = orderedmap_find_path(&map, "zz.inner");
+        REQUIRE(node != nullptr);
+        REQUIRE(node->omn_block != nullptr);
+        REQUIRE(strcmp(node->omn_val, "1") == 0);
+        REQUIRE(orderedmap_memory_usage(&map, &usage) == 0);
+        REQUIRE(usage.omu_numnodes == ref.size() + 2);
+
+        REQUIRE(internpool_init(&pool) == 0);
+        REQUIRE(orderedmap_init(&pooled) == 0);
+        REQUIRE(orderedmap_bind_pool(&pooled, &pool) == 0);
+        for (const auto &[key, val] : ref)
+            REQUIRE(orderedmap_insert(&pooled, key.c_str(),
+                                      val.c_str()) == 0);
+        REQUIRE(orderedmap_compact(&pooled) == 0);
+        check_map(&pooled, ref);
+        REQUIRE(internpool_count(&pool) == ref.size());
+        REQUIRE(orderedmap_destroy(&pooled) == 0);
+        REQUIRE(internpool_destroy(&pool) == 0);
+    }
+
+    REQUIRE(orderedmap_destroy(&map) == 0);
+}
+
+static void
+count_release(void *buf, void *arg)
+{
+    free(buf);
+    (*static_cast<int *>(arg))++;
+}
+
+TEST_CASE("Ordered map borrowed storage", "[orderedmap]") {
+    orderedmap_t map;
+    orderedmapnode_t *node;
+    const char text[] = "alpha=1\nbeta=22\ngamma=333\n";
+    std::map<std::string, std::string> ref;
+    int released = 0;
+
+    /* parse into slices of a buffer the map adopts */
+    char *buf = static_cast<char *>(malloc(sizeof(text)));
+    memcpy(buf, text, sizeof(text));
+
+    REQUIRE(orderedmap_init(&map) == 0);
+    for (char *line = buf; *line != '\0';) {
+        char *eq = strchr(line, '=');
+        char *nl = strchr(eq, '\n');
+
+        REQUIRE(orderedmap_insert_borrowed(&map, line, eq - line, eq + 1,
+                                           nl - eq - 1) == 0);
+        ref.emplace(std::string(line, eq), std::string(eq + 1, nl));
+        line = nl + 1;
+    }
+    REQUIRE(orderedmap_insert_borrowed(&map, "beta", 4, "x", 1) == EPERM);
+    REQUIRE(orderedmap_adopt(&map, buf, count_release, &released) == 0);
+    check_map(&map, ref);
+
+    /* the nodes point into the buffer, unterminated */
+    node = orderedmap_findn(&map, "beta", 4);
+    REQUIRE(node != nullptr);
+    REQUIRE(node->omn_borrowed);
+    REQUIRE(node->omn_key == buf + 8);
+    REQUIRE(std::string(node->omn_val, node->omn_vallen) == "22");
+    REQUIRE(node->omn_val[node->omn_vallen] == '\n');
+
+    SECTION("a new value is copied, not written to the buffer") {
+        REQUIRE(orderedmap_update_int(&map, "gamma", 4) == 0);
+        node = orderedmap_find(&map, "gamma");
+        REQUIRE_FALSE(node->omn_borrowed);
+        REQUIRE(strcmp(node->omn_val, "4") == 0);
+        REQUIRE(memcmp(buf, text, sizeof(text)) == 0);
+    }
+
+    SECTION("compaction keeps pointing at the buffer") {
+        orderedmap_usage_t usage;
+
+        REQUIRE(orderedmap_compact(&map) == 0);
+        check_map(&map, ref);
+        node = orderedmap_find(&map, "alpha");
+        REQUIRE(node->omn_block != nullptr);
+        REQUIRE(node->omn_key == buf);
+        REQUIRE(orderedmap_memory_usage(&map, &usage) == 0);
+        REQUIRE(usage.omu_nodebytes == 3 * sizeof(orderedmapnode_t));
+    }
+
+    SECTION("an adopted buffer outlives clear") {
+        REQUIRE(orderedmap_clear(&map) == 0);
+        REQUIRE(released == 0);
+        REQUIRE(orderedmap_adopt(&map, malloc(16), nullptr, nullptr) == 0);
+    }
+
+    REQUIRE(orderedmap_destroy(&map) == 0);
+    REQUIRE(released == 1);
+}
+
+static int
+collect_diff(orderedmap_diffop_t op, const orderedmapnode_t *const *path,
+             size_t depth, const orderedmapnode_t *oldnode,
+             const orderedmapnode_t *newnode, void *ctx)
+{
+    auto *out = static_cast<std::vector<std::string> *>(ctx);
+    const char *tag[] = { "+", "-", "~" };
+    const orderedmapnode_t *node = newnode ? newnode : oldnode;
+    std::string key(tag[op]);
+
+    for (size_t i = 0; i < depth; i++)
+        key += std::string(path[i]->omn_key) + ".";
+    out->push_back(key + node->omn_key);
+    return 0;
+}
+
+TEST_CASE("Ordered map diff and patch", "[orderedmap]") {
+    orderedmap_t oldmap, newmap, live;
+    orderedmap_patch_t patch;
+    std::vector<std::string> diff;
+    orderedmapnode_t *a, *b;
+
+    REQUIRE(orderedmap_init(&oldmap) == 0);
+    REQUIRE(orderedmap_init(&newmap) == 0);
+    REQUIRE(orderedmap_init(&live) == 0);
+    for (const char *key : { "a", "b", "c", "d", "e" }) {
+        REQUIRE(orderedmap_insert(&oldmap, key, key) == 0);
+        REQUIRE(orderedmap_insert(&live, key, key) == 0);
+    }
+    REQUIRE(orderedmap_insert(&newmap, "a", "a") == 0);
+    REQUIRE(orderedmap_insert(&newmap, "b", "longer value") == 0);
+    REQUIRE(orderedmap_insert(&newmap, "bb", "new") == 0);
+    REQUIRE(orderedmap_insert(&newmap, "d", "") == 0);
+    REQUIRE(orderedmap_insert(&newmap, "f", "f") == 0);
+
+    SECTION("diff reports changes in key order") {
+        REQUIRE(orderedmap_diff(&oldmap, &newmap, collect_diff, &diff) == 0);
+        REQUIRE(diff == std::vector<std::string>{ "~b", "+bb", "-c", "~d",
+                                                  "-e", "+f" });
+
+        diff.clear();
+        REQUIRE(orderedmap_diff(&newmap, &newmap, collect_diff, &diff) == 0);
+        REQUIRE(diff.empty());
+    }
+
+    SECTION("diff needs the same ordering") {
+        orderedmap_t other;
+
+        REQUIRE(orderedmap_init_cmp(&other, orderedmap_cmp_case, NULL) == 0);
+        REQUIRE(orderedmap_diff(&oldmap, &other, collect_diff,
+                                &diff) == EINVAL);
+        REQUIRE(orderedmap_destroy(&other) == 0);
+    }
+
+    SECTION("patch brings a copy of the old map up to date") {
+        a = orderedmap_find(&live, "a");
+
+        REQUIRE(orderedmap_patch_init(&patch) == 0);
+        REQUIRE(orderedmap_diff(&oldmap, &newmap, orderedmap_patch_record,
+                                &patch) == 0);
+        REQUIRE(patch.omp_numentries == 6);
+        REQUIRE(orderedmap_apply_patch(&live, &patch) == 0);
+
+        /* untouched keys keep their nodes */
+        REQUIRE(orderedmap_find(&live, "a") == a);
+        REQUIRE(orderedmap_diff(&live, &newmap, collect_diff, &diff) == 0);
+        REQUIRE(diff.empty());
+
+        /* applying again is harmless */
+        REQUIRE(orderedmap_apply_patch(&live, &patch) == 0);
+        REQUIRE(live.om_numnodes == newmap.om_numnodes);
+        for (a = orderedmap_first(&live), b = orderedmap_first(&newmap);
+             a != nullptr; a = orderedmap_next(a), b = orderedmap_next(b))
+            REQUIRE(strcmp(a->omn_val, b->omn_val) == 0);
+        REQUIRE(orderedmap_patch_destroy(&patch) == 0);
+    }
+
+    REQUIRE(orderedmap_destroy(&oldmap) == 0);
+    REQUIRE(orderedmap_destroy(&newmap) == 0);
+    REQUIRE(orderedmap_destroy(&live) == 0);
+}
+
+TEST_CASE("Ordered map nested tables", "[orderedmap]") {
+    orderedmap_t map;
+    orderedmap_t *server, *tls, *again;
+    orderedmapnode_t *node;
+
+    REQUIRE(orderedmap_init(&map) == 0);
+    REQUIRE(orderedmap_insert(&map, "name", "edge") == 0);
+    REQUIRE(orderedmap_insert_map(&map, "server", &server) == 0);
+    REQUIRE(orderedmap_insert(server, "port", "443") == 0);
+    REQUIRE(orderedmap_insert_map(server, "tls", &tls) == 0);
+    REQUIRE(orderedmap_insert(tls, "cert", "/etc/cert.pem") == 0);
+
+    again = nullptr;
+    REQUIRE(orderedmap_insert_map(&map, "server", &again) == EPERM);
+    REQUIRE(again == server);
+    REQUIRE(orderedmap_insert_map(&map, "name", &again) == EPERM);
+
+    SECTION("path lookup") {
+        const char *segs[] = { "server", "tls", "cert" };
+
+        node = orderedmap_find_path(&map, "server.tls.cert");
+        REQUIRE(node != nullptr);
+        REQUIRE(strcmp(node->omn_val, "/etc/cert.pem") == 0);
+        REQUIRE(orderedmap_find_path_v(&map, segs, 3) == node);
+
+        node = orderedmap_find_path(&map, "server.tls");
+        REQUIRE(orderedmap_getmap(node) == tls);
+        REQUIRE(orderedmap_find_path(&map, "name") != nullptr);
+        REQUIRE(orderedmap_find_path(&map, "name.x") == nullptr);
+        REQUIRE(orderedmap_find_path(&map, "server.tl") == nullptr);
+        REQUIRE(orderedmap_find_path(&map, "server.tls.cert.x") == nullptr);
+        REQUIRE(orderedmap_find_path(&map, "server..port") == nullptr);
+        REQUIRE(orderedmap_find_path_v(&map, segs, 2) == node);
+    }
+
+    SECTION("update and diff copy tables") {
+        orderedmap_t copy;
+        orderedmap_patch_t patch;
+        std::vector<std::string> diff;
+
+        REQUIRE(orderedmap_init(&copy) == 0);
+        REQUIRE(orderedmap_update(&copy, &map) == 0);
+        REQUIRE(orderedmap_diff(&map, &copy, collect_diff, &diff) == 0);
+        REQUIRE(diff.empty());
+        REQUIRE(orderedmap_getmap(orderedmap_find_path(&copy,
+                                                       "server.tls")) != tls);
+
+        REQUIRE(orderedmap_insert(tls, "key", "/etc/key.pem") == 0);
+        REQUIRE(orderedmap_diff(&copy, &map, collect_diff, &diff) == 0);
+        REQUIRE(diff == std::vector<std::string>{ "+server.tls.key" });
+
+        REQUIRE(orderedmap_patch_init(&patch) == 0);
+        REQUIRE(orderedmap_diff(&copy, &map, orderedmap_patch_record,
+                                &patch) == 0);
+        REQUIRE(orderedmap_erase(tls, "key") == 0);
+        REQUIRE(orderedmap_apply_patch(&copy, &patch) == 0);
+        REQUIRE(orderedmap_patch_destroy(&patch) == 0);
+        REQUIRE(orderedmap_find_path(&copy, "server.tls.key") != nullptr);
+        REQUIRE(orderedmap_destroy(&copy) == 0);
+    }
+
+    SECTION("a table keeps its address while the key holds it") {
+        orderedmap_t other;
+        orderedmap_t *otls;
+
+        /* refilled by update rather than replaced */
+        REQUIRE(orderedmap_init(&other) == 0);
+        REQUIRE(orderedmap_insert_map(&other, "server", &again) == 0);
+        REQUIRE(orderedmap_insert_map(again, "tls", &otls) == 0);
+        REQUIRE(orderedmap_insert(otls, "cert", "/etc/other.pem") == 0);
+        REQUIRE(orderedmap_update(&map, &other) == 0);
+        REQUIRE(orderedmap_getmap(orderedmap_find(&map, "server")) == server);
+        REQUIRE(orderedmap_find(server, "port") == nullptr);
+        tls = orderedmap_getmap(orderedmap_find(server, "tls"));
+        REQUIRE(tls != nullptr);
+        REQUIRE(strcmp(orderedmap_find(tls, "cert")->omn_val,
+                       "/etc/other.pem") == 0);
+        REQUIRE(orderedmap_destroy(&other) == 0);
+    }
+
+    SECTION("a changed leaf is patched inside its table") {
+        orderedmap_t copy;
+        orderedmap_t *ctls;
+        orderedmap_patch_t patch;
+        orderedmapnode_t *port, *cert;
+        std::vector<std::string> diff;
+
+        REQUIRE(orderedmap_init(&copy) == 0);
+        REQUIRE(orderedmap_update(&copy, &map) == 0);
+        port = orderedmap_find_path(&copy, "server.port");
+        ctls = orderedmap_getmap(orderedmap_find_path(&copy, "server.tls"));
+        cert = orderedmap_find(ctls, "cert");
+
+        REQUIRE(orderedmap_erase(tls, "cert") == 0);
+        REQUIRE(orderedmap_insert(tls, "cert", "/etc/new.pem") == 0);
+        REQUIRE(orderedmap_insert(&map, "name", "x") == EPERM);
+        REQUIRE(orderedmap_diff(&copy, &map, collect_diff, &diff) == 0);
+        REQUIRE(diff == std::vector<std::string>{ "~server.tls.cert" });
+
+        REQUIRE(orderedmap_patch_init(&patch) == 0);
+        REQUIRE(orderedmap_diff(&copy, &map, orderedmap_patch_record,
+                                &patch) == 0);
+        REQUIRE(patch.omp_numentries == 1);
+        REQUIRE(orderedmap_apply_patch(&copy, &patch) == 0);
+
+        /* the tables and untouched leaves are the ones already there */
+        REQUIRE(orderedmap_getmap(orderedmap_find_path(&copy,
+                                                       "server.tls")) == ctls);
+        REQUIRE(orderedmap_find_path(&copy, "server.port") == port);
+        REQUIRE(orderedmap_find(ctls, "cert") == cert);
+        REQUIRE(strcmp(cert->omn_val, "/etc/new.pem") == 0);
+
+        /* a patch builds missing tables and skips removals below them */
+        REQUIRE(orderedmap_erase(&copy, "server") == 0);
+        REQUIRE(orderedmap_apply_patch(&copy, &patch) == 0);
+        node = orderedmap_find_path(&copy, "server.tls.cert");
+        REQUIRE(node != nullptr);
+        REQUIRE(strcmp(node->omn_val, "/etc/new.pem") == 0);
+        REQUIRE(orderedmap_find_path(&copy, "server.port") == nullptr);
+        REQUIRE(orderedmap_patch_destroy(&patch) == 0);
+
+        REQUIRE(orderedmap_erase(tls, "cert") == 0);
+        REQUIRE(orderedmap_patch_init(&patch) == 0);
+        REQUIRE(orderedmap_diff(&copy, &map, orderedmap_patch_record,
+                                &patch) == 0);
+        REQUIRE(orderedmap_erase(&copy, "server") == 0);
+        REQUIRE(orderedmap_apply_patch(&copy, &patch) == 0);
+        REQUIRE(orderedmap_find_path(&copy, "server.port") != nullptr);
+        REQUIRE(orderedmap_find_path(&copy, "server.tls") == nullptr);
+        REQUIRE(orderedmap_patch_destroy(&patch) == 0);
+        REQUIRE(orderedmap_destroy(&copy) == 0);
+    }
+
+    REQUIRE(orderedmap_erase(&map, "server") == 0);
+    REQUIRE(orderedmap_destroy(&map) == 0);
 }
@@ -0,0 +1,140 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <algorithm>
+#include <concepts>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <libcmap/orderedmap.hpp>
+
+static_assert(std::bidirectional_iterator<cmap::ordered_map<>::iterator>);
+static_assert(std::same_as<
+    std::iterator_traits<cmap::ordered_map<>::iterator>::iterator_category,
+    std::input_iterator_tag>);
+static_assert(cmap::map_key_compare<cmap::bytes_compare>);
+static_assert(std::same_as<cmap::ordered_map<>::key_compare,
+                           cmap::bytes_compare>);
+
+TEST_CASE("Ordered map wrapper", "[orderedmap]") {
+
+    SECTION("insert and lookup by view") {
+        cmap::ordered_map<> map;
+        std::string buf = "alpha.beta";
+
+        REQUIRE(map.insert("alpha", "1").second);
+        REQUIRE(map.insert("beta", "2").second);
+        REQUIRE_FALSE(map.insert("alpha", "3").second);
+        REQUIRE(map.size() == 2);
+
+        /* view into a larger buffer, not null terminated */
+        auto it = map.find(std::string_view(buf).substr(0, 5));
+        REQUIRE(it != map.end());
+        REQUIRE(it->second == "1");
+        REQUIRE(map.contains(std::string_view(buf).substr(6)));
+        REQUIRE_FALSE(map.contains("alph"));
+
+        REQUIRE(map.erase("alpha") == 1);
+        REQUIRE(map.erase("alpha") == 0);
+        REQUIRE(map.size() == 1);
+    }
+
+    SECTION("iteration is ordered") {
+        cmap::ordered_map<> map;
+        std::vector<std::string> keys;
+
+        for (const char *key : { "c", "a", "d", "b" })
+            map.insert(key, key);
+        for (auto [key, val] : map)
+            keys.emplace_back(key);
+        REQUIRE(keys == std::vector<std::string>{ "a", "b", "c", "d" });
+        REQUIRE(std::distance(map.begin(), map.end()) == 4);
+
+        keys.clear();
+        for (auto it = map.rbegin(); it != map.rend(); ++it)
+            keys.emplace_back(it->first);
+        REQUIRE(keys == std::vector<std::string>{ "d", "c", "b", "a" });
+        REQUIRE(std::ranges::prev(map.end())->first == "d");
+    }
+
+    SECTION("hinted insert") {
+        cmap::ordered_map<> map;
+        std::vector<std::string> keys;
+
+        for (const char *key : { "b", "d", "f" }) {
+            auto it = map.insert(map.end(), key, "");
+            REQUIRE(it == std::ranges::prev(map.end()));
+        }
+        auto it = map.insert(map.find("d"), "c", "");
+        REQUIRE(it->first == "c");
+        REQUIRE(map.insert(map.begin(), "a", "")->first == "a");
+        /* a hint that is far off still puts the key in order */
+        REQUIRE(map.insert(map.begin(), "e", "")->first == "e");
+        REQUIRE(map.insert(map.end(), "c", "x")->second == "");
+
+        for (auto [key, val] : map)
+            keys.emplace_back(key);
+        REQUIRE(keys == std::vector<std::string>{ "a", "b", "c", "d", "e",
+                                                  "f" });
+    }
+
+    SECTION("case comparator") {
+        cmap::ordered_map<cmap::case_compare> map;
+
+        REQUIRE(map.insert("Host", "example").second);
+        REQUIRE_FALSE(map.insert("HOST", "other").second);
+        REQUIRE(map.find("host")->second == "example");
+    }
+
+    SECTION("natural comparator agrees with the C library") {
+        cmap::ordered_map<cmap::natural_compare> map;
+        std::vector<std::string> keys = { "v1.10", "v1.9", "v1.2", "v10",
+                                          "v2", "v01", "v1" };
+        std::vector<std::string> order;
+
+        for (const auto &key : keys)
+            REQUIRE(map.insert(key, "").second);
+        for (auto [key, val] : map)
+            order.emplace_back(key);
+
+        std::sort(keys.begin(), keys.end(),
+                  [](const std::string &a, const std::string &b) {
+                      return orderedmap_cmp_natural(a.data(), a.size(),
+                                                    b.data(), b.size(),
+                                                    nullptr) < 0;
+                  });
+        REQUIRE(order == keys);
+        REQUIRE(order.front() == "v1");
+        REQUIRE(order.back() == "v10");
+    }
+
+    SECTION("move keeps the comparator") {
+        cmap::ordered_map<cmap::case_compare> map;
+
+        map.insert("Key", "1");
+        cmap::ordered_map<cmap::case_compare> other(std::move(map));
+        REQUIRE(map.empty());
+        REQUIRE(other.insert("b", "2").second);
+        REQUIRE(other.contains("KEY"));
+        REQUIRE(map.insert("x", "y").second);
+    }
+
+    SECTION("move keeps the comparator of nested tables") {
+        auto map = std::make_unique<cmap::ordered_map<cmap::case_compare>>();
+        orderedmap_t *child, *deeper;
+
+        REQUIRE(orderedmap_insert_map(map->native_handle(), "t", &child) == 0);
+        REQUIRE(orderedmap_insert_map(child, "u", &deeper) == 0);
+        REQUIRE(orderedmap_insert(deeper, "Key", "1") == 0);
+
+        cmap::ordered_map<cmap::case_compare> other(std::move(*map));
+        map.reset();
+        REQUIRE(child->om_cmpctx == &other.key_comp());
+        REQUIRE(deeper->om_cmpctx == &other.key_comp());
+        REQUIRE(orderedmap_insert(deeper, "KEY", "2") == EPERM);
+        REQUIRE(orderedmap_find_path(other.native_handle(), "t.u.key")
+                != nullptr);
+    }
+}
@@ -0,0 +1,152 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+extern "C"
+{
+    #include <libcmap.h>
+}
+
+static std::vector<std::string>
+values(const orderedmultimapnode_t *node)
+{
+    std::vector<std::string> out;
+
+    for (const char *val = orderedmultimap_value_first(node); val != nullptr;
+         val = orderedmultimap_value_next(node, val))
+        out.emplace_back(val);
+    return out;
+}
+
+TEST_CASE("Ordered multimap", "[orderedmultimap]") {
+
+    SECTION("init") {
+        orderedmultimap_t mm;
+
+        REQUIRE(orderedmultimap_init(&mm) == 0);
+        REQUIRE(orderedmultimap_destroy(&mm) == 0);
+    }
+
+    SECTION("duplicate keys share a node") {
+        orderedmultimap_t mm;
+        orderedmultimapnode_t *node;
+        const char *vals[2];
+
+        REQUIRE(orderedmultimap_init(&mm) == 0);
+        REQUIRE(orderedmultimap_insert(&mm, "set-cookie", "a=1") == 0);
+        REQUIRE(orderedmultimap_insert(&mm, "accept", "*/*") == 0);
+        REQUIRE(orderedmultimap_insert(&mm, "set-cookie", "b=2") == 0);
+        REQUIRE(orderedmultimap_insert(&mm, "set-cookie", "") == 0);
+        REQUIRE(orderedmultimap_insertn(&mm, "x", 1, "a\0b", 3) == EINVAL);
+
+        REQUIRE(mm.omm_map.om_numnodes == 2);
+        REQUIRE(mm.omm_numvals == 4);
+        REQUIRE(orderedmultimap_count(&mm, "set-cookie") == 3);
+        REQUIRE(orderedmultimap_count(&mm, "missing") == 0);
+
+        node = orderedmultimap_equal_range(&mm, "set-cookie");
+        REQUIRE(node != nullptr);
+        REQUIRE(values(node) == std::vector<std::string>{ "a=1", "b=2", "" });
+
+        REQUIRE(orderedmultimap_find_all(&mm, "set-cookie", vals, 2) == 3);
+        REQUIRE(strcmp(vals[0], "a=1") == 0);
+        REQUIRE(strcmp(vals[1], "b=2") == 0);
+
+        node = orderedmultimap_first(&mm);
+        REQUIRE(strcmp(node->ommn_node.omn_key, "accept") == 0);
+        node = orderedmultimap_next(node);
+        REQUIRE(strcmp(node->ommn_node.omn_key, "set-cookie") == 0);
+        REQUIRE(orderedmultimap_next(node) == nullptr);
+        REQUIRE(orderedmultimap_destroy(&mm) == 0);
+    }
+
+    SECTION("erase one and all") {
+        orderedmultimap_t mm;
+
+        REQUIRE(orderedmultimap_init(&mm) == 0);
+        for (const char *val : { "1", "2", "1", "3" })
+            REQUIRE(orderedmultimap_insert(&mm, "k", val) == 0);
+        REQUIRE(orderedmultimap_insert(&mm, "j", "0") == 0);
+
+        REQUIRE(orderedmultimap_erase_one(&mm, "k", "1") == 0);
+        REQUIRE(values(orderedmultimap_equal_range(&mm, "k")) ==
+                std::vector<std::string>{ "2", "1", "3" });
+        REQUIRE(orderedmultimap_erase_one(&mm, "k", "4") == ENOENT);
+        REQUIRE(orderedmultimap_erase_one(&mm, "k", "3") == 0);
+        REQUIRE(orderedmultimap_insert(&mm, "k", "5") == 0);
+        REQUIRE(values(orderedmultimap_equal_range(&mm, "k")) ==
+                std::vector<std::string>{ "2", "1", "5" });
+
+        REQUIRE(orderedmultimap_erase_one(&mm, "j", "0") == 0);
+        REQUIRE(orderedmultimap_equal_range(&mm, "j") == nullptr);
+        REQUIRE(orderedmultimap_erase_all(&mm, "k") == 0);
+        REQUIRE(orderedmultimap_erase_all(&mm, "k") == ENOENT);
+        REQUIRE(mm.omm_numvals == 0);
+        REQUIRE(mm.omm_map.om_numnodes == 0);
+        REQUIRE(orderedmultimap_destroy(&mm) == 0);
+    }
+
+    SECTION("first run is stored in the node") {
+        orderedmultimap_t mm;
+        orderedmultimapnode_t *node;
+        const char *inrun;
+        std::vector<std::string> ref;
+
+        REQUIRE(orderedmultimap_init(&mm) == 0);
+        REQUIRE(orderedmultimap_insert(&mm, "via", "proxy-0") == 0);
+        node = orderedmultimap_equal_range(&mm, "via");
+        inrun = node->ommn_node.omn_key + node->ommn_node.omn_keylen + 1;
+        REQUIRE(node->ommn_run == inrun);
+        ref.push_back("proxy-0");
+
+        /* the run spills once it outgrows the node and keeps its order */
+        for (int i = 1; i < 64; i++) {
+            std::string val = "proxy-" + std::to_string(i);
+            REQUIRE(orderedmultimap_insert(&mm, "via", val.c_str()) == 0);
+            ref.push_back(val);
+        }
+        REQUIRE(node->ommn_run != inrun);
+        REQUIRE(values(node) == ref);
+
+        /* a long first value gets a node sized to hold it */
+        std::string big(100, 'x');
+        REQUIRE(orderedmultimap_insert(&mm, "big", big.c_str()) == 0);
+        node = orderedmultimap_equal_range(&mm, "big");
+        REQUIRE(node->ommn_run == node->ommn_node.omn_key + 4);
+        REQUIRE(values(node) == std::vector<std::string>{ big });
+        REQUIRE(orderedmultimap_destroy(&mm) == 0);
+    }
+
+    SECTION("matches std::multimap") {
+        orderedmultimap_t mm;
+        orderedmultimapnode_t *node;
+        std::multimap<std::string, std::string> ref;
+
+        REQUIRE(orderedmultimap_init(&mm) == 0);
+        for (int i = 0; i < 3000; i++) {
+            std::string key = "h" + std::to_string((i * 37) % 101);
+            std::string val = std::to_string(i);
+
+            REQUIRE(orderedmultimap_insert(&mm, key.c_str(),
+                                           val.c_str()) == 0);
+            ref.emplace(key, val);
+        }
+        REQUIRE(mm.omm_map.om_numnodes == 101);
+        REQUIRE(mm.omm_numvals == ref.size());
+
+        auto it = ref.begin();
+        for (node = orderedmultimap_first(&mm); node != nullptr;
+             node = orderedmultimap_next(node)) {
+            for (const auto &val : values(node)) {
+                REQUIRE(it->first == node->ommn_node.omn_key);
+                REQUIRE(it->second == val);
+                ++it;
+            }
+        }
+        REQUIRE(it == ref.end());
+        REQUIRE(orderedmultimap_destroy(&mm) == 0);
+    }
+}
@@ -0,0 +1,187 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+extern "C"
+{
+    #include <libcmap.h>
+}
+
+static void
+require_same(const radixmap_t *map,
+             const std::map<std::string, std::string> &ref)
+{
+    radixmapnode_t *node;
+
+    REQUIRE(map->rm_numnodes == (int)ref.size());
+    node = radixmap_first(map);
+    for (const auto &[key, val] : ref) {
+        REQUIRE(node != nullptr);
+        REQUIRE(key == node->rmn_key);
+        REQUIRE(val == node->rmn_val);
+        REQUIRE(radixmap_find(map, key.c_str()) == node);
+        node = radixmap_next(node);
+    }
+    REQUIRE(node == nullptr);
+
+    node = radixmap_last(map);
+    for (auto it = ref.rbegin(); it != ref.rend(); ++it) {
+        REQUIRE(node != nullptr);
+        REQUIRE(it->first == node->rmn_key);
+        node = radixmap_prev(node);
+    }
+    REQUIRE(node == nullptr);
+}
+
+TEST_CASE("Radix map", "[radixmap]") {
+
+    SECTION("init") {
+        radixmap_t map;
+
+        REQUIRE(radixmap_init(&map) == 0);
+        REQUIRE(radixmap_destroy(&map) == 0);
+    }
+
+    SECTION("insert find erase") {
+        radixmap_t map;
+        radixmapnode_t *node;
+
+        REQUIRE(radixmap_init(&map) == 0);
+        REQUIRE(radixmap_insert(&map, "a.b", "1") == 0);
+        REQUIRE(radixmap_insert(&map, "a", "2") == 0);
+        REQUIRE(radixmap_insert(&map, "a.bc", "3") == 0);
+        REQUIRE(radixmap_insert(&map, "a", "x") == EPERM);
+        REQUIRE(radixmap_insertn(&map, "a\0b", 3, "x", 1) == EINVAL);
+
+        node = radixmap_find(&map, "a");
+        REQUIRE(node != nullptr);
+        REQUIRE(strcmp(node->rmn_val, "2") == 0);
+        REQUIRE(radixmap_find(&map, "a.") == nullptr);
+        REQUIRE(radixmap_find(&map, "a.bcd") == nullptr);
+        REQUIRE(radixmap_findn(&map, "a.bcd", 4) != nullptr);
+
+        REQUIRE(radixmap_erase(&map, "a.b") == 0);
+        REQUIRE(radixmap_erase(&map, "a.b") == ENOENT);
+        REQUIRE(radixmap_find(&map, "a.bc") != nullptr);
+
+        /* only the given bytes name the key */
+        REQUIRE(radixmap_erasen(&map, "a.bcd", 3) == ENOENT);
+        REQUIRE(radixmap_erasen(&map, "a\0b", 3) == ENOENT);
+        REQUIRE(radixmap_erasen(&map, "a.bcd", 4) == 0);
+        REQUIRE(radixmap_find(&map, "a.bc") == nullptr);
+        REQUIRE(radixmap_find(&map, "a") != nullptr);
+        REQUIRE(radixmap_destroy(&map) == 0);
+    }
+
+    SECTION("random dotted keys match std::map") {
+        radixmap_t map;
+        std::map<std::string, std::string> ref;
+        std::mt19937 rng(26);
+        const char *parts[] = { "cluster", "region-east", "region-west",
+                                "az1", "az2", "service", "setting", "x" };
+
+        REQUIRE(radixmap_init(&map) == 0);
+        for (int i = 0; i < 20000; i++) {
+            std::string key;
+            int depth = 1 + rng() % 5;
+
+            for (int d = 0; d < depth; d++) {
+                if (d != 0)
+                    key += '.';
+                key += parts[rng() % 8];
+            }
+            if (rng() % 4 == 0)
+                key += std::to_string(rng() % 300);
+
+            if (rng() % 3 == 0) {
+                REQUIRE(radixmap_erase(&map, key.c_str()) ==
+                        (ref.erase(key) ? 0 : ENOENT));
+                continue;
+            }
+            std::string val = std::to_string(i);
+            bool added = ref.emplace(key, val).second;
+            REQUIRE(radixmap_insert(&map, key.c_str(), val.c_str()) ==
+                    (added ? 0 : EPERM));
+        }
+        require_same(&map, ref);
+
+        /* drain through every node size on the way down */
+        std::vector<std::string> keys;
+        for (const auto &kv : ref)
+            keys.push_back(kv.first);
+        std::shuffle(keys.begin(), keys.end(), rng);
+        for (size_t i = 0; i < keys.size(); i++) {
+            REQUIRE(radixmap_erase(&map, keys[i].c_str()) == 0);
+            ref.erase(keys[i]);
+            if (i % 1000 == 0)
+                require_same(&map, ref);
+        }
+        require_same(&map, ref);
+        REQUIRE(map.rm_root == nullptr);
+        REQUIRE(radixmap_destroy(&map) == 0);
+    }
+
+    SECTION("wide fanout") {
+        radixmap_t map;
+        std::map<std::string, std::string> ref;
+
+        REQUIRE(radixmap_init(&map) == 0);
+        for (int c = 1; c < 256; c++) {
+            std::string key = "p";
+            key += (char)c;
+            REQUIRE(radixmap_insert(&map, key.c_str(), "v") == 0);
+            ref.emplace(key, "v");
+            require_same(&map, ref);
+        }
+        for (int c = 255; c > 0; c -= 2) {
+            std::string key = "p";
+            key += (char)c;
+            REQUIRE(radixmap_erase(&map, key.c_str()) == 0);
+            ref.erase(key);
+        }
+        require_same(&map, ref);
+        REQUIRE(radixmap_destroy(&map) == 0);
+    }
+
+    SECTION("prefix scan") {
+        radixmap_t map;
+        radixmapnode_t *first, *last;
+        std::vector<std::string> seen;
+
+        REQUIRE(radixmap_init(&map) == 0);
+        for (const char *key : { "db.primary.host", "db.primary.port",
+                                 "db.replica.host", "dbx", "web.port",
+                                 "db.primary.longer.than.ten.bytes" })
+            REQUIRE(radixmap_insert(&map, key, "v") == 0);
+
+        REQUIRE(radixmap_prefix(&map, "db.primary.", &first, &last) == 0);
+        REQUIRE(strcmp(first->rmn_key, "db.primary.host") == 0);
+        REQUIRE(strcmp(last->rmn_key, "db.primary.port") == 0);
+
+        REQUIRE(radixmap_walk_prefix(&map, "db",
+            [](const radixmapnode_t *node, void *ctx) {
+                static_cast<std::vector<std::string> *>(ctx)->push_back(
+                    node->rmn_key);
+                return 0;
+            }, &seen) == 0);
+        REQUIRE(seen.size() == 5);
+        REQUIRE(seen.back() == "dbx");
+
+        REQUIRE(radixmap_prefix(&map, "db.primary.longer.than.t",
+                                &first, &last) == 0);
+        REQUIRE(first == last);
+        REQUIRE(radixmap_prefix(&map, "db.primary.longer.than.x",
+                                &first, &last) == ENOENT);
+        REQUIRE(radixmap_prefix(&map, "web.portal", &first,
+                                &last) == ENOENT);
+        REQUIRE(radixmap_prefix(&map, "", &first, &last) == 0);
+        REQUIRE(first == radixmap_first(&map));
+        REQUIRE(last == radixmap_last(&map));
+        REQUIRE(radixmap_destroy(&map) == 0);
+    }
+}
@@ -0,0 +1,545 @@
+/*
+ * Copyright (c) 2012-2023  Charles Hardin <ckhardin@gmail.com>
+ * All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * - Redistributions of source code must retain the above copyright notice,
+ *   this list of conditions and the following disclaimer.
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+/**
+ * @file cmap_replay.c
+ *
+ * Replay a trace recorded by maptrace.h against one or more map
+ * backends and report the throughput, the per operation latency
+ * percentiles and the peak memory of each. The trace is loaded up
+ * front so reading it is not part of the timing, and every backend
+ * runs in its own child process so the peak memory is its own.
+ * Operations a backend cannot take, such as a key with a null byte
+ * for the radix map, still run but are counted as rejected so runs
+ * that did different work can be told apart.
+ *
+ *   cmap_replay [-b backend[,backend...]] trace
+ *   cmap_replay -l
+ */
+
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <libcmap.h>
+
+/* largest value a replayed insert synthesizes */
+#define REPLAY_MAXVAL	(64 * 1024 * 1024)
+
+struct replay_op {
+	maptrace_optype_t ro_type;
+	const char *ro_key;
+	size_t ro_keylen;
+	size_t ro_vallen;
+};
+
+struct replay_backend {
+	const char *rb_name;
+	void *(*rb_open)(void);
+	void (*rb_close)(void *map);
+	int (*rb_insert)(void *map, const char *key, size_t keylen,
+			 const char *val, size_t vallen);
+	bool (*rb_find)(void *map, const char *key, size_t keylen);
+	int (*rb_erase)(void *map, const char *key, size_t keylen);
+	void (*rb_clear)(void *map);
+	bool (*rb_keyok)(const char *key, size_t keylen); /* optional */
+};
+
+
+static void *
+_replay_orderedmap_open(void)
+{
+	orderedmap_t *map;
+
+	map = malloc(sizeof(*map));
+	if (map != NULL)
+		orderedmap_init(map);
+	return map;
+}
+
+
+static void
+_replay_orderedmap_close(void *map)
+{
+	orderedmap_destroy(map);
+	free(map);
+}
+
+
+static int
+_replay_orderedmap_insert(void *map, const char *key, size_t keylen,
+			  const char *val, size_t vallen)
+{
+	return orderedmap_insertn(map, key, keylen, val, vallen);
+}
+
+
+static bool
+_replay_orderedmap_find(void *map, const char *key, size_t keylen)
+{
+	return orderedmap_findn(map, key, keylen) != NULL;
+}
+
+
+static int
+_replay_orderedmap_erase(void *map, const char *key, size_t keylen)
+{
+	orderedmapnode_t *node;
+
+	/* by node so a key with a null byte erases the right entry */
+	node = orderedmap_findn(map, key, keylen);
+	if (node == NULL)
+		return ENOENT;
+	return orderedmap_erase_node(map, node);
+}
+
+
+static void
+_replay_orderedmap_clear(void *map)
+{
+	orderedmap_clear(map);
+}
+
+
+/* ordered map with the keys in a shared intern pool */
+struct replay_pooled {
+	orderedmap_t rp_map;
+	internpool_t rp_pool;
+};
+
+
+static void *
+_replay_pooled_open(void)
+{
+	struct replay_pooled *rp;
+
+	rp = malloc(sizeof(*rp));
+	if (rp == NULL)
+		return NULL;
+	internpool_init(&rp->rp_pool);
+	orderedmap_init(&rp->rp_map);
+	orderedmap_bind_pool(&rp->rp_map, &rp->rp_pool);
+	return &rp->rp_map;
+}
+
+
+static void
+_replay_pooled_close(void *map)
+{
+	struct replay_pooled *rp = map;
+
+	orderedmap_destroy(&rp->rp_map);
+	internpool_destroy(&rp->rp_pool);
+	free(rp);
+}
+
+
+static void *
+_replay_radixmap_open(void)
+{
+	radixmap_t *map;
+
+	map = malloc(sizeof(*map));
+	if (map != NULL)
+		radixmap_init(map);
+	return map;
+}
+
+
+static void
+_replay_radixmap_close(void *map)
+{
+	radixmap_destroy(map);
+	free(map);
+}
+
+
+static int
+_replay_radixmap_insert(void *map, const char *key, size_t keylen,
+			const char *val, size_t vallen)
+{
+	return radixmap_insertn(map, key, keylen, val, vallen);
+}
+
+
+static bool
+_replay_radixmap_find(void *map, const char *key, size_t keylen)
+{
+	return radixmap_findn(map, key, keylen) != NULL;
+}
+
+
+static int
+_replay_radixmap_erase(void *map, const char *key, size_t keylen)
+{
+	return radixmap_erasen(map, key, keylen);
+}
+
+
+static void
+_replay_radixmap_clear(void *map)
+{
+	radixmap_clear(map);
+}
+
+
+static bool
+_replay_radixmap_keyok(const char *key, size_t keylen)
+{
+	return memchr(key, '\0', keylen) == NULL;
+}
+
+
+static const struct replay_backend _replay_backends[] = {
+	{
+		"orderedmap",
+		_replay_orderedmap_open, _replay_orderedmap_close,
+		_replay_orderedmap_insert, _replay_orderedmap_find,
+		_replay_orderedmap_erase, _replay_orderedmap_clear,
+		NULL
+	},
+	{
+		"orderedmap-pool",
+		_replay_pooled_open, _replay_pooled_close,
+		_replay_orderedmap_insert, _replay_orderedmap_find,
+		_replay_orderedmap_erase, _replay_orderedmap_clear,
+		NULL
+	},
+	{
+		"radixmap",
+		_replay_radixmap_open, _replay_radixmap_close,
+		_replay_radixmap_insert, _replay_radixmap_find,
+		_replay_radixmap_erase, _replay_radixmap_clear,
+		_replay_radixmap_keyok
+	},
+	{ NULL }
+};
+
+
+static const struct replay_backend *
+_replay_backend(const char *name, size_t len)
+{
+	const struct replay_backend *rb;
+
+	for (rb = _replay_backends; rb->rb_name != NULL; rb++) {
+		if (strlen(rb->rb_name) == len &&
+		    strncmp(rb->rb_name, name, len) == 0)
+			return rb;
+	}
+	return NULL;
+}
+
+
+static uint64_t
+_replay_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+static long
+_replay_maxrss(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_maxrss; /* kilobytes */
+}
+
+
+static int
+_replay_cmp(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+
+/* permille percentile of sorted latencies, nearest rank */
+static uint64_t
+_replay_percentile(const uint64_t *lat, size_t n, size_t permille)
+{
+	size_t rank;
+
+	rank = (n * permille + 999) / 1000;
+	return lat[rank ? rank - 1 : 0];
+}
+
+
+static int
+_replay_run(const struct replay_backend *rb, const struct replay_op *ops,
+	    size_t nops, const char *val)
+{
+	void *map;
+	int err;
+	bool keyok;
+	size_t i, rejected;
+	long baserss, peakrss;
+	uint64_t start, end, t0, t1;
+	uint64_t *lat;
+	const struct replay_op *op;
+
+	lat = malloc((nops ? nops : 1) * sizeof(*lat));
+	if (lat == NULL)
+		return ENOMEM;
+	memset(lat, 0, (nops ? nops : 1) * sizeof(*lat));
+
+	baserss = _replay_maxrss();
+	map = rb->rb_open();
+	if (map == NULL) {
+		free(lat);
+		return ENOMEM;
+	}
+
+	/*
+	 * An existing key on insert or a missing one on find and erase is
+	 * part of the workload, anything else the backend refused is
+	 * counted as rejected.
+	 */
+	rejected = 0;
+	start = _replay_now();
+	for (i = 0; i < nops; i++) {
+		op = &ops[i];
+		keyok = op->ro_type == MAPTRACE_CLEAR || rb->rb_keyok == NULL ||
+			rb->rb_keyok(op->ro_key, op->ro_keylen);
+		err = 0;
+		t0 = _replay_now();
+		switch (op->ro_type) {
+		case MAPTRACE_INSERT:
+			err = rb->rb_insert(map, op->ro_key, op->ro_keylen,
+					    val, op->ro_vallen);
+			break;
+		case MAPTRACE_FIND:
+			rb->rb_find(map, op->ro_key, op->ro_keylen);
+			break;
+		case MAPTRACE_ERASE:
+			err = rb->rb_erase(map, op->ro_key, op->ro_keylen);
+			break;
+		case MAPTRACE_CLEAR:
+			rb->rb_clear(map);
+			break;
+		}
+		t1 = _replay_now();
+		lat[i] = t1 - t0;
+		if (!keyok || (err != 0 && err != EPERM && err != ENOENT))
+			rejected++;
+	}
+	end = _replay_now();
+	peakrss = _replay_maxrss();
+	rb->rb_close(map);
+
+	qsort(lat, nops, sizeof(*lat), _replay_cmp);
+	printf("%-16s %10zu %10zu %12.0f %10llu %10llu %10llu %12ld %12ld\n",
+	       rb->rb_name, nops, rejected,
+	       end > start ? nops / ((end - start) / 1e9) : 0.0,
+	       (unsigned long long)(nops ? _replay_percentile(lat, nops, 500) : 0),
+	       (unsigned long long)(nops ? _replay_percentile(lat, nops, 990) : 0),
+	       (unsigned long long)(nops ? _replay_percentile(lat, nops, 999) : 0),
+	       peakrss, peakrss - baserss);
+	free(lat);
+	return 0;
+}
+
+
+static int
+_replay_load(maptrace_reader_t *reader, struct replay_op **opsp,
+	     size_t *nopsp, size_t *maxvalp)
+{
+	int err;
+	size_t nops, maxops;
+	struct replay_op *ops, *tmp;
+	maptrace_op_t op;
+
+	ops = NULL;
+	nops = maxops = 0;
+	*maxvalp = 0;
+	while ((err = maptrace_read(reader, &op)) == 0) {
+		if (nops == maxops) {
+			maxops = maxops ? maxops * 2 : 4096;
+			tmp = realloc(ops, maxops * sizeof(*ops));
+			if (tmp == NULL) {
+				err = ENOMEM;
+				break;
+			}
+			ops = tmp;
+		}
+		if (op.mto_vallen > REPLAY_MAXVAL) {
+			err = EFBIG;
+			break;
+		}
+		if (op.mto_vallen > *maxvalp)
+			*maxvalp = op.mto_vallen;
+		ops[nops].ro_type = op.mto_type;
+		ops[nops].ro_key = op.mto_key;
+		ops[nops].ro_keylen = op.mto_keylen;
+		ops[nops].ro_vallen = op.mto_vallen;
+		nops++;
+	}
+	if (err != ENOENT) {
+		free(ops);
+		return err;
+	}
+	*opsp = ops;
+	*nopsp = nops;
+	return 0;
+}
+
+
+static void
+_replay_usage(FILE *fp)
+{
+	const struct replay_backend *rb;
+
+	fprintf(fp, "usage: cmap_replay [-b backend[,backend...]] trace\n"
+		    "       cmap_replay -l\n\nbackends:");
+	for (rb = _replay_backends; rb->rb_name != NULL; rb++)
+		fprintf(fp, " %s", rb->rb_name);
+	fprintf(fp, "\n");
+}
+
+
+int
+main(int argc, char *argv[])
+{
+	int ch, err, status;
+	size_t i, nops, maxval, nrun;
+	const char *list, *name, *comma;
+	const struct replay_backend *run[16];
+	const struct replay_backend *rb;
+	struct replay_op *ops;
+	maptrace_reader_t reader;
+	char *val;
+	pid_t pid;
+
+	list = NULL;
+	while ((ch = getopt(argc, argv, "b:hl")) != -1) {
+		switch (ch) {
+		case 'b':
+			list = optarg;
+			break;
+		case 'l':
+			for (rb = _replay_backends; rb->rb_name != NULL; rb++)
+				printf("%s\n", rb->rb_name);
+			return 0;
+		case 'h':
+			_replay_usage(stdout);
+			return 0;
+		default:
+			_replay_usage(stderr);
+			return 2;
+		}
+	}
+	if (optind + 1 != argc) {
+		_replay_usage(stderr);
+		return 2;
+	}
+
+	nrun = 0;
+	if (list == NULL) {
+		for (rb = _replay_backends; rb->rb_name != NULL; rb++)
+			run[nrun++] = rb;
+	} else {
+		for (name = list; *name != '\0'; name = comma + (*comma != '\0')) {
+			comma = strchr(name, ',');
+			if (comma == NULL)
+				comma = name + strlen(name);
+			rb = _replay_backend(name, comma - name);
+			if (rb == NULL || nrun == sizeof(run) / sizeof(run[0])) {
+				fprintf(stderr, "cmap_replay: unknown backend "
+					"%.*s\n", (int)(comma - name), name);
+				return 2;
+			}
+			run[nrun++] = rb;
+		}
+	}
+
+	err = maptrace_reader_open(&reader, argv[optind]);
+	if (err != 0) {
+		fprintf(stderr, "cmap_replay: %s: %s\n", argv[optind],
+			strerror(err));
+		return 1;
+	}
+	err = _replay_load(&reader, &ops, &nops, &maxval);
+	if (err != 0) {
+		fprintf(stderr, "cmap_replay: %s: %s\n", argv[optind],
+			strerror(err));
+		maptrace_reader_close(&reader);
+		return 1;
+	}
+
+	/* inserts take their value from one shared buffer */
+	status = 0;
+	val = malloc(maxval + 1);
+	if (val == NULL) {
+		fprintf(stderr, "cmap_replay: %s\n", strerror(ENOMEM));
+		status = 1;
+		goto out;
+	}
+	memset(val, 'v', maxval);
+	val[maxval] = '\0';
+
+	printf("%-16s %10s %10s %12s %10s %10s %10s %12s %12s\n", "backend",
+	       "ops", "rejected", "ops/s", "p50 ns", "p99 ns", "p999 ns",
+	       "peak KiB", "growth KiB");
+	for (i = 0; i < nrun; i++) {
+		fflush(stdout);
+		pid = fork();
+		if (pid < 0) {
+			fprintf(stderr, "cmap_replay: fork: %s\n",
+				strerror(errno));
+			status = 1;
+			break;
+		}
+		if (pid == 0) {
+			err = _replay_run(run[i], ops, nops, val);
+			if (err != 0)
+				fprintf(stderr, "cmap_replay: %s: %s\n",
+					run[i]->rb_name, strerror(err));
+			fflush(stdout);
+			_exit(err != 0);
+		}
+		if (waitpid(pid, &ch, 0) < 0 || !WIFEXITED(ch) ||
+		    WEXITSTATUS(ch) != 0)
+			status = 1;
+	}
+
+ out:
+	free(val);
+	free(ops);
+	maptrace_reader_close(&reader);
+	return status;
+}